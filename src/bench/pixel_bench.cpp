@@ -0,0 +1,110 @@
+//Times every pixel kernel implementation this CPU supports against the scalar one, after
+//checking that they agree. Usage: PixelBench [iterations]
+#include "../core/pixel_kernels.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t TILES = 512;      // 8KB of CHR
+constexpr size_t LINES = 240;
+constexpr size_t PIXELS = 256 * LINES;
+
+struct Inputs {
+    vector<uint8_t> chr = vector<uint8_t>(TILES * 16);
+    //Lines padded by 16 like the PPU's background buffer
+    vector<uint8_t> background = vector<uint8_t>(LINES * 272);
+    vector<uint8_t> sprites = vector<uint8_t>(PIXELS);
+    vector<uint8_t> palette = vector<uint8_t>(32);
+    vector<uint8_t> indices = vector<uint8_t>(PIXELS);
+};
+
+struct Outputs {
+    vector<uint8_t> tiles = vector<uint8_t>(TILES * 64);
+    vector<uint8_t> colors = vector<uint8_t>(PIXELS);
+    vector<uint8_t> pixels = vector<uint8_t>(PIXELS);
+    vector<uint32_t> rgba = vector<uint32_t>(PIXELS);
+    long hits = 0;
+};
+
+static Inputs make_inputs() {
+    Inputs in;
+    mt19937 rng(12345);
+    for (auto &b: in.chr)
+        b = rng();
+    for (auto &b: in.background)
+        b = rng() & 0x0F;
+    //Mostly transparent sprites, like a real line
+    for (auto &b: in.sprites)
+        b = rng() % 4 == 0 ? rng() & (0x0F | SPRITE_BEHIND | SPRITE_ZERO) : 0;
+    for (auto &b: in.palette)
+        b = rng() & 0x3F;
+    for (auto &b: in.indices)
+        b = rng() & 0x3F;
+    return in;
+}
+
+static void run(const PixelKernels &k, const Inputs &in, Outputs &out) {
+    k.decode_tiles(in.chr.data(), out.tiles.data(), TILES);
+    out.hits = 0;
+    for (size_t y = 0; y < LINES; y++) {
+        out.hits += k.mix_line(in.background.data() + y * 272 + (y & 7), in.sprites.data() + y * 256,
+                               out.colors.data() + y * 256, y & 1 ? 8 : 0, y & 2 ? 8 : 0);
+    }
+    k.lookup_palette(out.colors.data(), in.palette.data(), 0x3F, out.pixels.data(), PIXELS);
+    k.expand_rgba(in.indices.data(), NES_PALETTE_RGBA.data(), out.rgba.data(), PIXELS);
+}
+
+template<class F>
+static double ns_per_call(int iterations, F f) {
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        f();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    Inputs in = make_inputs();
+    vector<const PixelKernels *> kernels = available_pixel_kernels();
+
+    Outputs reference;
+    run(*kernels[0], in, reference);
+    bool ok = true;
+    for (const PixelKernels *k: kernels) {
+        Outputs out;
+        run(*k, in, out);
+        bool same = out.tiles == reference.tiles && out.colors == reference.colors &&
+                    out.pixels == reference.pixels && out.rgba == reference.rgba && out.hits == reference.hits;
+        if (!same) {
+            printf("%s: output differs from scalar\n", k->name);
+            ok = false;
+        }
+    }
+
+    printf("%-8s %12s %12s %12s %12s   (ns per frame, %d iterations)\n", "kernels", "decode 8KB", "mix",
+           "palette", "rgba", iterations);
+    for (const PixelKernels *k: kernels) {
+        Outputs out;
+        double decode = ns_per_call(iterations, [&] { k->decode_tiles(in.chr.data(), out.tiles.data(), TILES); });
+        double mix = ns_per_call(iterations, [&] {
+            for (size_t y = 0; y < LINES; y++)
+                out.hits += k->mix_line(in.background.data() + y * 272, in.sprites.data() + y * 256,
+                                        out.colors.data() + y * 256, 8, 8);
+        });
+        double palette = ns_per_call(iterations, [&] {
+            k->lookup_palette(out.colors.data(), in.palette.data(), 0x3F, out.pixels.data(), PIXELS);
+        });
+        double rgba = ns_per_call(iterations, [&] {
+            k->expand_rgba(in.indices.data(), NES_PALETTE_RGBA.data(), out.rgba.data(), PIXELS);
+        });
+        printf("%-8s %12.0f %12.0f %12.0f %12.0f\n", k->name, decode, mix, palette, rgba);
+    }
+    printf("selected: %s\n", pixel_kernels().name);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,500 @@
+#include "apu.h"
+
+using namespace std;
+
+namespace {
+    constexpr array<uint8_t, 32> LENGTH_TABLE = {
+            10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+            12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+    };
+
+    constexpr array<array<uint8_t, 8>, 4> DUTY_TABLE = {{
+            {0, 1, 0, 0, 0, 0, 0, 0},
+            {0, 1, 1, 0, 0, 0, 0, 0},
+            {0, 1, 1, 1, 1, 0, 0, 0},
+            {1, 0, 0, 1, 1, 1, 1, 1}
+    }};
+
+    constexpr array<uint8_t, 32> TRIANGLE_TABLE = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+
+    //In CPU cycles, NTSC
+    constexpr array<uint16_t, 16> NOISE_PERIODS = {
+            4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+    };
+
+    constexpr array<uint16_t, 16> DMC_RATES = {
+            428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+    };
+
+    //Frame counter steps in CPU cycles from the $4017 write; the last one wraps the sequence
+    constexpr array<uint32_t, 4> FOUR_STEP = {7457, 14913, 22371, 29829};
+    constexpr array<uint32_t, 5> FIVE_STEP = {7457, 14913, 22371, 29829, 37281};
+    constexpr uint32_t FOUR_STEP_PERIOD = 29830;
+    constexpr uint32_t FIVE_STEP_PERIOD = 37282;
+
+    //The usual linear approximation of the 2A03's mixer (pulse 0.00752, triangle 0.00851,
+    //noise 0.00494, DMC 0.00335 per step), scaled so everything at full volume stays inside
+    //16 bits. Being linear, each channel's steps can go to the buffer on their own.
+    constexpr array<int, 5> CHANNEL_WEIGHTS = {286, 286, 323, 188, 127};
+
+    enum Channel {
+        PULSE_1, PULSE_2, TRIANGLE, NOISE, DMC
+    };
+}
+
+void Envelope::clock() {
+    if (start) {
+        start = false;
+        decay = 15;
+        divider = period;
+    } else if (divider == 0) {
+        divider = period;
+        if (decay > 0)
+            decay--;
+        else if (loop)
+            decay = 15;
+    } else {
+        divider--;
+    }
+}
+
+int Pulse::output() const {
+    if (length == 0 || period < 8 || sweep_target() > 0x7FF || !DUTY_TABLE[duty][step])
+        return 0;
+    return envelope.volume();
+}
+
+int Pulse::sweep_target() const {
+    int change = period >> sweep_shift;
+    if (!sweep_negate)
+        return period + change;
+    return max(0, period - change - (ones_complement ? 1 : 0));
+}
+
+void Pulse::clock_sweep() {
+    int target = sweep_target();
+    if (sweep_divider == 0 && sweep_enabled && sweep_shift > 0 && period >= 8 && target <= 0x7FF)
+        period = target;
+    if (sweep_divider == 0 || sweep_reload) {
+        sweep_divider = sweep_period;
+        sweep_reload = false;
+    } else {
+        sweep_divider--;
+    }
+}
+
+int Triangle::output() const {
+    return TRIANGLE_TABLE[step];
+}
+
+void Triangle::clock_linear() {
+    if (linear_reload)
+        linear = linear_period;
+    else if (linear > 0)
+        linear--;
+    if (!control)
+        linear_reload = false;
+}
+
+int Noise::output() const {
+    if (length == 0 || (shift & 1))
+        return 0;
+    return envelope.volume();
+}
+
+Apu::Apu(int sample_rate) : rate(sample_rate), blip(CPU_CLOCK_RATE, sample_rate, CYCLES_PER_FRAME) {
+    pulses[0].ones_complement = true;
+}
+
+void Apu::attach(Memory &mem, Scheduler &sched, InterruptLines &lines, const uint64_t &cpu_clock) {
+    memory = &mem;
+    scheduler = &sched;
+    interrupts = &lines;
+    clock = &cpu_clock;
+    memory->map_mmio(0x40, 1, {register_read, register_write, this});
+    frame_counter_id = scheduler->add_event(frame_counter_event, this);
+    dmc_id = scheduler->add_event(dmc_event, this);
+    batch_id = scheduler->add_event(batch_event, this);
+
+    time = batch_start = *clock;
+    pulses[0].next = pulses[1].next = triangle.next = noise.next = dmc.next = time;
+    blip.clear();
+    write_frame_counter(0);
+    scheduler->schedule(batch_id, batch_start + CYCLES_PER_FRAME);
+}
+
+void Apu::reset() {
+    run_until(*clock);
+    write_register(0x4015, 0);
+    frame_irq = false;
+    update_levels();
+    update_irq();
+}
+
+void Apu::set_sample_callback(SampleCallback callback, void *context) {
+    sample_callback = callback;
+    sample_context = context;
+}
+
+void Apu::set_sample_target(SampleTarget target, void *context) {
+    sample_target = target;
+    target_context = context;
+}
+
+uint8_t Apu::register_read(void *context, uint16_t address) {
+    auto *apu = static_cast<Apu *>(context);
+    if (address != 0x4015)
+        return 0;
+    apu->run_until(*apu->clock);
+    uint8_t status = (apu->pulses[0].length > 0) | (apu->pulses[1].length > 0) << 1 |
+                     (apu->triangle.length > 0) << 2 | (apu->noise.length > 0) << 3 |
+                     (apu->dmc.bytes_remaining > 0) << 4 | apu->frame_irq << 6 | apu->dmc.irq << 7;
+    apu->frame_irq = false;
+    apu->update_irq();
+    return status;
+}
+
+void Apu::register_write(void *context, uint16_t address, uint8_t value) {
+    auto *apu = static_cast<Apu *>(context);
+    if (address == 0x4014) {
+        //OAM DMA: the page goes to $2004 in one go, and the CPU is held for the 256 reads
+        //and writes it really takes, one more to start, and another to line up with a
+        //read cycle when it starts on an odd one
+        for (int i = 0; i < 0x100; i++)
+            apu->memory->write_byte(0x2004, apu->memory->read_byte((value << 8) | i));
+        apu->scheduler->stall_cpu(513, true);
+        return;
+    }
+    if (address > 0x4017 || address == 0x4016)
+        return;
+    apu->run_until(*apu->clock);
+    apu->write_register(address, value);
+    apu->update_levels();
+    apu->update_irq();
+}
+
+void Apu::frame_counter_event(void *context, uint64_t time) {
+    auto *apu = static_cast<Apu *>(context);
+    apu->run_until(time);
+    size_t step = apu->frame_step;
+    if (apu->five_step) {
+        if (step != 3)
+            apu->quarter_frame();
+        if (step == 1 || step == 4)
+            apu->half_frame();
+    } else {
+        apu->quarter_frame();
+        if (step == 1 || step == 3)
+            apu->half_frame();
+        if (step == 3 && !apu->irq_inhibit)
+            apu->frame_irq = true;
+    }
+    if (++apu->frame_step == (apu->five_step ? FIVE_STEP.size() : FOUR_STEP.size())) {
+        apu->frame_step = 0;
+        apu->sequence_start += apu->five_step ? FIVE_STEP_PERIOD : FOUR_STEP_PERIOD;
+    }
+    apu->update_levels();
+    apu->update_irq();
+    apu->schedule_frame_counter();
+}
+
+void Apu::dmc_event(void *context, uint64_t time) {
+    auto *apu = static_cast<Apu *>(context);
+    apu->run_until(time);
+    apu->update_irq();
+    apu->schedule_dmc();
+}
+
+void Apu::batch_event(void *context, uint64_t time) {
+    auto *apu = static_cast<Apu *>(context);
+    apu->run_until(time);
+    apu->blip.end_frame(static_cast<uint32_t>(time - apu->batch_start));
+    apu->batch_start = time;
+    size_t available = apu->blip.samples_available();
+    int16_t *out = apu->sample_target ? apu->sample_target(apu->target_context, available) : nullptr;
+    if (!out) {
+        apu->batch.resize(available);
+        out = apu->batch.data();
+    }
+    size_t count = apu->blip.read_samples(out, available);
+    if (apu->sample_callback)
+        apu->sample_callback(apu->sample_context, out, count);
+    apu->scheduler->schedule(apu->batch_id, time + CYCLES_PER_FRAME);
+}
+
+void Apu::run_until(uint64_t end) {
+    if (end <= time)
+        return;
+    run_pulse(pulses[0], PULSE_1, end);
+    run_pulse(pulses[1], PULSE_2, end);
+    run_triangle(end);
+    run_noise(end);
+    run_dmc(end);
+    time = end;
+}
+
+//Each channel loop goes from timer expiry to timer expiry. While a channel can't change its
+//output (silenced, or frozen) the expiries in between are skipped in one go.
+
+void Apu::run_pulse(Pulse &pulse, int index, uint64_t end) {
+    //The pulse timers count APU cycles, two CPU cycles each
+    uint64_t period = (pulse.period + 1) * 2;
+    if (pulse.next <= end && (pulse.length == 0 || pulse.period < 8 || pulse.envelope.volume() == 0)) {
+        uint64_t steps = (end - pulse.next) / period + 1;
+        pulse.step = (pulse.step + steps) & 7;
+        pulse.next += steps * period;
+    }
+    for (; pulse.next <= end; pulse.next += period) {
+        pulse.step = (pulse.step + 1) & 7;
+        set_level(index, pulse.output(), pulse.next);
+    }
+}
+
+void Apu::run_triangle(uint64_t end) {
+    uint64_t period = triangle.period + 1;
+    //Periods under 2 are ultrasonic; holding the level is what they'd average out to anyway
+    if (triangle.next <= end && (triangle.length == 0 || triangle.linear == 0 || triangle.period < 2)) {
+        triangle.next += ((end - triangle.next) / period + 1) * period;
+    }
+    for (; triangle.next <= end; triangle.next += period) {
+        triangle.step = (triangle.step + 1) & 31;
+        set_level(TRIANGLE, triangle.output(), triangle.next);
+    }
+}
+
+void Apu::run_noise(uint64_t end) {
+    uint64_t period = noise.period;
+    //Silent, the shift register isn't worth stepping; its state is random enough as it is
+    if (noise.next <= end && (noise.length == 0 || noise.envelope.volume() == 0))
+        noise.next += ((end - noise.next) / period + 1) * period;
+    for (; noise.next <= end; noise.next += period) {
+        int feedback = (noise.shift ^ (noise.shift >> (noise.short_mode ? 6 : 1))) & 1;
+        noise.shift = (noise.shift >> 1) | (feedback << 14);
+        set_level(NOISE, noise.output(), noise.next);
+    }
+}
+
+void Apu::run_dmc(uint64_t end) {
+    if (dmc.next <= end && dmc.silence && !dmc.buffer_full) {
+        uint64_t steps = (end - dmc.next) / dmc.rate + 1;
+        int bits = dmc.bits_remaining - static_cast<int>(steps % 8);
+        dmc.bits_remaining = bits <= 0 ? bits + 8 : bits;
+        dmc.shift = steps >= 8 ? 0 : dmc.shift >> steps;
+        dmc.next += steps * dmc.rate;
+    }
+    for (; dmc.next <= end; dmc.next += dmc.rate) {
+        if (!dmc.silence) {
+            if (dmc.shift & 1) {
+                if (dmc.level <= 125)
+                    dmc.level += 2;
+            } else if (dmc.level >= 2) {
+                dmc.level -= 2;
+            }
+            set_level(DMC, dmc.level, dmc.next);
+        }
+        dmc.shift >>= 1;
+        if (--dmc.bits_remaining == 0) {
+            dmc.bits_remaining = 8;
+            dmc.silence = !dmc.buffer_full;
+            if (dmc.buffer_full) {
+                dmc.shift = dmc.sample_buffer;
+                dmc.buffer_full = false;
+                dmc_fetch();
+            }
+        }
+    }
+}
+
+void Apu::set_level(int channel, int level, uint64_t at) {
+    int delta = level - levels[channel];
+    if (delta == 0)
+        return;
+    levels[channel] = level;
+    blip.add_delta(static_cast<uint32_t>(at - batch_start), delta * CHANNEL_WEIGHTS[channel]);
+}
+
+void Apu::update_levels() {
+    set_level(PULSE_1, pulses[0].output(), time);
+    set_level(PULSE_2, pulses[1].output(), time);
+    set_level(TRIANGLE, triangle.output(), time);
+    set_level(NOISE, noise.output(), time);
+    set_level(DMC, dmc.output(), time);
+}
+
+void Apu::write_register(uint16_t address, uint8_t value) {
+    Pulse &pulse = pulses[(address >> 2) & 1];
+    switch (address) {
+        case 0x4000:
+        case 0x4004:
+            pulse.duty = value >> 6;
+            pulse.halt = pulse.envelope.loop = value & 0x20;
+            pulse.envelope.constant = value & 0x10;
+            pulse.envelope.period = value & 0x0F;
+            break;
+        case 0x4001:
+        case 0x4005:
+            pulse.sweep_enabled = value & 0x80;
+            pulse.sweep_period = (value >> 4) & 7;
+            pulse.sweep_negate = value & 0x08;
+            pulse.sweep_shift = value & 7;
+            pulse.sweep_reload = true;
+            break;
+        case 0x4002:
+        case 0x4006:
+            pulse.period = (pulse.period & 0x700) | value;
+            break;
+        case 0x4003:
+        case 0x4007:
+            pulse.period = (pulse.period & 0xFF) | (value & 7) << 8;
+            if (enabled & (1 << ((address >> 2) & 1)))
+                pulse.length = LENGTH_TABLE[value >> 3];
+            pulse.step = 0;
+            pulse.envelope.start = true;
+            break;
+        case 0x4008:
+            triangle.control = value & 0x80;
+            triangle.linear_period = value & 0x7F;
+            break;
+        case 0x400A:
+            triangle.period = (triangle.period & 0x700) | value;
+            break;
+        case 0x400B:
+            triangle.period = (triangle.period & 0xFF) | (value & 7) << 8;
+            if (enabled & 0x04)
+                triangle.length = LENGTH_TABLE[value >> 3];
+            triangle.linear_reload = true;
+            break;
+        case 0x400C:
+            noise.halt = noise.envelope.loop = value & 0x20;
+            noise.envelope.constant = value & 0x10;
+            noise.envelope.period = value & 0x0F;
+            break;
+        case 0x400E:
+            noise.short_mode = value & 0x80;
+            noise.period = NOISE_PERIODS[value & 0x0F];
+            break;
+        case 0x400F:
+            if (enabled & 0x08)
+                noise.length = LENGTH_TABLE[value >> 3];
+            noise.envelope.start = true;
+            break;
+        case 0x4010:
+            dmc.irq_enabled = value & 0x80;
+            if (!dmc.irq_enabled)
+                dmc.irq = false;
+            dmc.loop = value & 0x40;
+            dmc.rate = DMC_RATES[value & 0x0F];
+            schedule_dmc();
+            break;
+        case 0x4011:
+            dmc.level = value & 0x7F;
+            break;
+        case 0x4012:
+            dmc.sample_address = 0xC000 + value * 64;
+            break;
+        case 0x4013:
+            dmc.sample_length = value * 16 + 1;
+            break;
+        case 0x4015:
+            enabled = value & 0x1F;
+            if (!(enabled & 0x01))
+                pulses[0].length = 0;
+            if (!(enabled & 0x02))
+                pulses[1].length = 0;
+            if (!(enabled & 0x04))
+                triangle.length = 0;
+            if (!(enabled & 0x08))
+                noise.length = 0;
+            if (!(enabled & 0x10)) {
+                dmc.bytes_remaining = 0;
+            } else if (dmc.bytes_remaining == 0) {
+                dmc.address = dmc.sample_address;
+                dmc.bytes_remaining = dmc.sample_length;
+                dmc_fetch();
+            }
+            dmc.irq = false;
+            schedule_dmc();
+            break;
+        case 0x4017:
+            write_frame_counter(value);
+            break;
+        default:
+            break;
+    }
+}
+
+//The sequence really restarts 3 or 4 cycles after the write; here it is immediate
+void Apu::write_frame_counter(uint8_t value) {
+    five_step = value & 0x80;
+    irq_inhibit = value & 0x40;
+    if (irq_inhibit)
+        frame_irq = false;
+    frame_step = 0;
+    sequence_start = time;
+    if (five_step) {
+        quarter_frame();
+        half_frame();
+    }
+    schedule_frame_counter();
+}
+
+void Apu::quarter_frame() {
+    pulses[0].envelope.clock();
+    pulses[1].envelope.clock();
+    noise.envelope.clock();
+    triangle.clock_linear();
+}
+
+void Apu::half_frame() {
+    for (Pulse &pulse : pulses) {
+        if (!pulse.halt && pulse.length > 0)
+            pulse.length--;
+        pulse.clock_sweep();
+    }
+    if (!triangle.control && triangle.length > 0)
+        triangle.length--;
+    if (!noise.halt && noise.length > 0)
+        noise.length--;
+}
+
+void Apu::schedule_frame_counter() {
+    uint32_t offset = five_step ? FIVE_STEP[frame_step] : FOUR_STEP[frame_step];
+    scheduler->schedule(frame_counter_id, sequence_start + offset);
+}
+
+void Apu::dmc_fetch() {
+    if (dmc.buffer_full || dmc.bytes_remaining == 0)
+        return;
+    //The CPU is held for up to 4 cycles while this happens; 4 is the usual case
+    dmc.sample_buffer = memory->read_byte(dmc.address);
+    scheduler->stall_cpu(4);
+    dmc.buffer_full = true;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if (--dmc.bytes_remaining == 0) {
+        if (dmc.loop) {
+            dmc.address = dmc.sample_address;
+            dmc.bytes_remaining = dmc.sample_length;
+        } else if (dmc.irq_enabled) {
+            dmc.irq = true;
+        }
+    }
+}
+
+//The next byte is fetched when the output unit takes the one in the buffer, after the bits
+//left in the shift register. Every fetch is an event, as it stalls the CPU (and the last
+//one may raise the IRQ).
+void Apu::schedule_dmc() {
+    if (dmc.bytes_remaining == 0 || !dmc.buffer_full) {
+        scheduler->cancel(dmc_id);
+        return;
+    }
+    scheduler->schedule(dmc_id, dmc.next + (dmc.bits_remaining - 1ull) * dmc.rate);
+}
+
+void Apu::update_irq() {
+    interrupts->set_irq(IRQ_APU_FRAME, frame_irq);
+    interrupts->set_irq(IRQ_APU_DMC, dmc.irq);
+}
@@ -0,0 +1,240 @@
+#ifndef NESEMULATOR_APU_H
+#define NESEMULATOR_APU_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "state.h"
+#include "scheduler.h"
+#include "blip_buffer.h"
+
+constexpr double CPU_CLOCK_RATE = 1789773; // NTSC
+//One NTSC video frame, 89342 / 3 dots rounded; the APU hands out samples this often
+constexpr uint32_t CYCLES_PER_FRAME = 29781;
+constexpr int DEFAULT_SAMPLE_RATE = 48000;
+
+//Called with each batch of mono samples, once per CYCLES_PER_FRAME
+typedef void (*SampleCallback)(void *context, const int16_t *samples, size_t count);
+
+//Lends room for a batch of count samples to be read straight into; the sample callback gets
+//the same pointer back. Null when it hasn't the room, and the APU's own buffer is used.
+typedef int16_t *(*SampleTarget)(void *context, size_t count);
+
+//Quarter frame clock: volume envelope of the pulse and noise channels
+struct Envelope {
+    void clock();
+
+    [[nodiscard]] int volume() const {
+        return constant ? period : decay;
+    }
+
+    bool start = false;
+    bool loop = false;
+    bool constant = false;
+    uint8_t period = 0;
+    uint8_t divider = 0;
+    uint8_t decay = 0;
+};
+
+struct Pulse {
+    [[nodiscard]] int output() const;
+
+    //Where the sweep unit would set the period; also mutes the channel past $7FF
+    [[nodiscard]] int sweep_target() const;
+
+    void clock_sweep();
+
+    //Pulse 1 negates in one's complement, pulse 2 in two's complement
+    bool ones_complement = false;
+    Envelope envelope;
+    uint8_t duty = 0;
+    uint8_t step = 0;
+    uint16_t period = 0;
+    uint8_t length = 0;
+    bool halt = false;
+
+    bool sweep_enabled = false;
+    bool sweep_negate = false;
+    bool sweep_reload = false;
+    uint8_t sweep_period = 0;
+    uint8_t sweep_shift = 0;
+    uint8_t sweep_divider = 0;
+
+    //CPU cycle of the next timer expiry
+    uint64_t next = 0;
+};
+
+struct Triangle {
+    [[nodiscard]] int output() const;
+
+    void clock_linear();
+
+    uint8_t step = 0;
+    uint16_t period = 0;
+    uint8_t length = 0;
+    //Also the length counter halt
+    bool control = false;
+    bool linear_reload = false;
+    uint8_t linear_period = 0;
+    uint8_t linear = 0;
+
+    uint64_t next = 0;
+};
+
+struct Noise {
+    [[nodiscard]] int output() const;
+
+    Envelope envelope;
+    uint16_t shift = 1;
+    bool short_mode = false;
+    uint16_t period = 4;
+    uint8_t length = 0;
+    bool halt = false;
+
+    uint64_t next = 0;
+};
+
+struct Dmc {
+    [[nodiscard]] int output() const {
+        return level;
+    }
+
+    bool irq_enabled = false;
+    bool loop = false;
+    bool irq = false;
+    uint16_t rate = 428;
+    uint8_t level = 0;
+    uint16_t sample_address = 0xC000;
+    uint16_t sample_length = 1;
+
+    //Memory reader
+    uint16_t address = 0xC000;
+    uint16_t bytes_remaining = 0;
+    uint8_t sample_buffer = 0;
+    bool buffer_full = false;
+
+    //Output unit
+    uint8_t shift = 0;
+    uint8_t bits_remaining = 8;
+    bool silence = true;
+
+    uint64_t next = 0;
+};
+
+//The 2A03's sound channels and frame counter on $4000-$4017.
+//
+//The APU runs lazily: nothing happens per cycle. Register accesses and its own events
+//(frame counter steps, DMC sample fetches, the end of each sample batch) first catch it
+//up to the current cycle, which steps each channel from one timer expiry to the next and
+//feeds every change in its output to a BlipBuffer. Samples come out in one batch per
+//CYCLES_PER_FRAME.
+//
+//The rest of page $40 is taken too: $4014 (OAM DMA) copies to $2004 and stalls the CPU
+//for the 513-514 cycles it takes; controllers aren't emulated and read as 0. DMC fetches
+//stall the CPU 4 cycles each. Stalls go through Scheduler::stall_cpu.
+class Apu {
+public:
+    explicit Apu(int sample_rate = DEFAULT_SAMPLE_RATE);
+
+    //Takes over page $40. clock is read on register accesses to timestamp them; it is the
+    //CPU's cycle count, current to the start of the running instruction.
+    void attach(Memory &memory, Scheduler &scheduler, InterruptLines &lines, const uint64_t &clock);
+
+    //The reset line: silences every channel, as a $4015 write of 0 does
+    void reset();
+
+    //Receives every batch of samples; without one they are dropped
+    void set_sample_callback(SampleCallback callback, void *context);
+
+    //Has batches read into buffers target lends rather than the APU's own
+    void set_sample_target(SampleTarget target, void *context);
+
+    [[nodiscard]] int sample_rate() const {
+        return rate;
+    }
+
+private:
+    static uint8_t register_read(void *context, uint16_t address);
+
+    static void register_write(void *context, uint16_t address, uint8_t value);
+
+    static void frame_counter_event(void *context, uint64_t time);
+
+    static void dmc_event(void *context, uint64_t time);
+
+    static void batch_event(void *context, uint64_t time);
+
+    //Brings every channel up to cycle end
+    void run_until(uint64_t end);
+
+    void run_pulse(Pulse &pulse, int index, uint64_t end);
+
+    void run_triangle(uint64_t end);
+
+    void run_noise(uint64_t end);
+
+    void run_dmc(uint64_t end);
+
+    //Moves channel's output to level at cycle at, adding the step to the blip buffer
+    void set_level(int channel, int level, uint64_t at);
+
+    //Picks up output changes made outside the timers (registers, frame counter clocks)
+    void update_levels();
+
+    void write_register(uint16_t address, uint8_t value);
+
+    void write_frame_counter(uint8_t value);
+
+    void quarter_frame();
+
+    void half_frame();
+
+    //Posts frame_step's time, counted from sequence_start
+    void schedule_frame_counter();
+
+    //Refills the DMC sample buffer from memory if it is empty and bytes remain
+    void dmc_fetch();
+
+    //Posts the cycle of the next DMC sample fetch
+    void schedule_dmc();
+
+    void update_irq();
+
+    int rate;
+    BlipBuffer blip;
+    std::vector<int16_t> batch;
+    SampleCallback sample_callback = nullptr;
+    void *sample_context = nullptr;
+    SampleTarget sample_target = nullptr;
+    void *target_context = nullptr;
+
+    Memory *memory = nullptr;
+    Scheduler *scheduler = nullptr;
+    InterruptLines *interrupts = nullptr;
+    const uint64_t *clock = nullptr;
+    int frame_counter_id = -1;
+    int dmc_id = -1;
+    int batch_id = -1;
+
+    //Everything has been run up to this cycle
+    uint64_t time = 0;
+    //Cycle the current sample batch started at
+    uint64_t batch_start = 0;
+
+    std::array<Pulse, 2> pulses;
+    Triangle triangle;
+    Noise noise;
+    Dmc dmc;
+    //Current output of each channel (pulse 1, pulse 2, triangle, noise, DMC)
+    std::array<int, 5> levels = {};
+    //$4015 channel enables, bit 0 pulse 1 to bit 4 DMC
+    uint8_t enabled = 0;
+
+    bool five_step = false;
+    bool irq_inhibit = false;
+    bool frame_irq = false;
+    size_t frame_step = 0;
+    uint64_t sequence_start = 0;
+};
+
+#endif //NESEMULATOR_APU_H
@@ -2,7 +2,6 @@
 #define NESEMULATOR_BASICS_H
 
 #include <utility>
-#include <functional>
 #include <stdexcept>
 
 struct Addr {
@@ -164,57 +163,4 @@ struct ZeroPageAddr {
     }
 };
 
-class ValReference {
-private:
-    std::function<Val()> getter;
-    std::function<void(Val)> setter;
-
-public:
-    ValReference(std::function<Val()> getter, std::function<void(Val)> setter)
-            : getter(std::move(getter)), setter(std::move(setter)) {}
-
-    [[nodiscard]] Val get() const {
-        return getter();
-    }
-
-    void set(Val value) {
-        setter(value);
-    }
-};
-
-class AddrOrVal {
-private:
-    bool is_addr;
-    Addr addr;
-    Val val;
-
-public:
-    AddrOrVal(bool isAddr, const Addr &addr, const Val &val) : is_addr(isAddr), addr(addr), val(val) {}
-
-public:
-    static AddrOrVal create_addr(Addr addr) {
-        return {true, addr, Val(0)};
-    };
-
-    static AddrOrVal create_val(Val val) {
-        return {false, Addr(0), val};
-    };
-
-    static AddrOrVal create(bool is_address, Addr addr, Val val) {
-        return is_address ? create_addr(addr) : create_val(val);
-    };
-
-    Addr getAddr() {
-        if (!is_addr)
-            throw std::invalid_argument("Not an address");
-        return addr;
-    };
-
-    Val getVal() {
-        if (is_addr)
-            throw std::invalid_argument("Not a value");
-        return val;
-    };
-};
-
 #endif //NESEMULATOR_BASICS_H
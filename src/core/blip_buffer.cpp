@@ -0,0 +1,62 @@
+#include "blip_buffer.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+using namespace std;
+
+BlipBuffer::BlipBuffer(double clock_rate, int sample_rate, uint32_t max_frame_clocks)
+        : factor(static_cast<uint64_t>(ldexp(sample_rate / clock_rate, FRAC_BITS))) {
+    //Room for a whole frame of unread samples plus the tail of the last impulse
+    buffer.resize(static_cast<size_t>(max_frame_clocks * (sample_rate / clock_rate)) + 2 * KERNEL_WIDTH + 1);
+
+    //Blackman-windowed sinc with its cutoff a little below Nyquist, sampled at PHASES
+    //sub-sample offsets. Rounding is pushed into the largest tap so every phase sums
+    //exactly to 1 << DELTA_BITS and steps integrate to their full height.
+    constexpr double cutoff = 0.9;
+    constexpr double pi = numbers::pi;
+    for (int phase = 0; phase < PHASES; phase++) {
+        array<double, KERNEL_WIDTH> taps;
+        double sum = 0;
+        for (int i = 0; i < KERNEL_WIDTH; i++) {
+            double x = i - KERNEL_WIDTH / 2 + 1 - static_cast<double>(phase) / PHASES;
+            double sinc = x == 0 ? cutoff : sin(pi * cutoff * x) / (pi * x);
+            double u = (x + KERNEL_WIDTH / 2) / KERNEL_WIDTH;
+            taps[i] = sinc * (0.42 - 0.5 * cos(2 * pi * u) + 0.08 * cos(4 * pi * u));
+            sum += taps[i];
+        }
+        int total = 0;
+        for (int i = 0; i < KERNEL_WIDTH; i++) {
+            kernel[phase][i] = static_cast<int16_t>(lround(taps[i] / sum * (1 << DELTA_BITS)));
+            total += kernel[phase][i];
+        }
+        auto peak = max_element(kernel[phase].begin(), kernel[phase].end());
+        *peak = static_cast<int16_t>(*peak + (1 << DELTA_BITS) - total);
+    }
+}
+
+void BlipBuffer::end_frame(uint32_t clock_duration) {
+    offset += clock_duration * factor;
+}
+
+size_t BlipBuffer::read_samples(int16_t *out, size_t count) {
+    size_t n = min(count, samples_available());
+    for (size_t i = 0; i < n; i++) {
+        integrator += buffer[i];
+        int64_t sample = clamp<int64_t>(integrator >> DELTA_BITS, INT16_MIN, INT16_MAX);
+        out[i] = static_cast<int16_t>(sample);
+        integrator -= sample << (DELTA_BITS - BASS_SHIFT);
+    }
+    //Impulses reach past the last readable sample; keep those for the next read
+    size_t pending = samples_available() - n + KERNEL_WIDTH;
+    copy(buffer.begin() + n, buffer.begin() + n + pending, buffer.begin());
+    fill(buffer.begin() + pending, buffer.begin() + n + pending, 0);
+    offset -= static_cast<uint64_t>(n) << FRAC_BITS;
+    return n;
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    integrator = 0;
+    fill(buffer.begin(), buffer.end(), 0);
+}
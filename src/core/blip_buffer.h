@@ -0,0 +1,58 @@
+#ifndef NESEMULATOR_BLIP_BUFFER_H
+#define NESEMULATOR_BLIP_BUFFER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Band-limited step synthesis. Sound sources only report the clock times at which their
+//output steps, and each step is added as a windowed-sinc impulse spread over a few samples;
+//integrating the buffer then gives the band-limited waveform. Nothing runs per clock, and
+//square waves don't alias at any pitch.
+class BlipBuffer {
+public:
+    //max_frame_clocks is the longest frame end_frame will be called with
+    BlipBuffer(double clock_rate, int sample_rate, uint32_t max_frame_clocks);
+
+    //A step of delta at clock_time clocks into the current frame
+    void add_delta(uint32_t clock_time, int delta) {
+        uint64_t position = offset + clock_time * factor;
+        const std::array<int16_t, KERNEL_WIDTH> &impulse = kernel[(position >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+        int32_t *out = buffer.data() + (position >> FRAC_BITS);
+        for (int i = 0; i < KERNEL_WIDTH; i++)
+            out[i] += impulse[i] * delta;
+    }
+
+    //Ends the current frame after clock_duration clocks; its samples become readable and
+    //the next frame's clock times start from there
+    void end_frame(uint32_t clock_duration);
+
+    [[nodiscard]] size_t samples_available() const {
+        return offset >> FRAC_BITS;
+    }
+
+    //Moves up to count samples into out, returns how many it moved
+    size_t read_samples(int16_t *out, size_t count);
+
+    void clear();
+
+private:
+    static constexpr int KERNEL_WIDTH = 16;
+    static constexpr int PHASE_BITS = 5;
+    static constexpr int PHASES = 1 << PHASE_BITS;
+    //Sample positions are fixed point with this many fraction bits
+    static constexpr int FRAC_BITS = 32;
+    //Each kernel phase sums to 1 << DELTA_BITS
+    static constexpr int DELTA_BITS = 12;
+    //The integrator leaks at this rate, which removes DC (about 15Hz at 48kHz)
+    static constexpr int BASS_SHIFT = 9;
+
+    uint64_t factor;
+    uint64_t offset = 0;
+    int64_t integrator = 0;
+    std::vector<int32_t> buffer;
+    std::array<std::array<int16_t, KERNEL_WIDTH>, PHASES> kernel = {};
+};
+
+#endif //NESEMULATOR_BLIP_BUFFER_H
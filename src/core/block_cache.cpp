@@ -0,0 +1,157 @@
+#include "block_cache.h"
+#include "fusion.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+    //Whether the code on page can't have changed after a write: it has to land in RAM, so
+    //it can't switch banks, and not on the code's own bytes (mirrors included)
+    bool keeps_code(const Memory &memory, const uint8_t *page, WriteTarget target, uint16_t operand) {
+        int written;
+        switch (target) {
+            case WriteTarget::NONE:
+                return true;
+            case WriteTarget::OPERAND:
+                written = operand >> 8;
+                break;
+            case WriteTarget::ZERO_PAGE:
+                written = 0;
+                break;
+            case WriteTarget::STACK:
+                written = 1;
+                break;
+            default:
+                return false;
+        }
+        return memory.page_writable(written) && memory.read_page(written) != page;
+    }
+
+    //What an opcode can do in an idle loop
+    enum class Poll : uint8_t {
+        NO,
+        //Only touches registers
+        REGISTERS,
+        //Reads its zp or abs operand
+        READ,
+        //Branches or jumps, back to the start if it's to be idle
+        LOOP
+    };
+
+    constexpr array<Poll, 256> poll_ref() {
+        array<Poll, 256> res{};
+        for (uint8_t opcode : {0xA9, 0xA2, 0xA0, 0xC9, 0xE0, 0xC0, 0x29, 0x09, 0x49, 0x69, 0xE9, 0xAA, 0xA8,
+                               0x8A, 0x98, 0xBA, 0xE8, 0xC8, 0xCA, 0x88, 0x18, 0x38, 0xB8, 0xEA, 0x0A, 0x4A,
+                               0x2A, 0x6A})
+            res[opcode] = Poll::REGISTERS;
+        for (uint8_t opcode : {0xAD, 0xAE, 0xAC, 0x2C, 0xCD, 0xEC, 0xCC, 0x2D, 0x0D, 0x4D, 0x6D, 0xED,
+                               0xA5, 0xA6, 0xA4, 0x24, 0xC5, 0xE4, 0xC4, 0x25, 0x05, 0x45, 0x65, 0xE5})
+            res[opcode] = Poll::READ;
+        for (uint8_t opcode : {0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0, 0x4C})
+            res[opcode] = Poll::LOOP;
+        return res;
+    }
+
+    constexpr array<Poll, 256> polls = poll_ref();
+
+    //Whether code, decoded at pc, is a loop that only polls (see Block::idle_loop)
+    bool is_idle_loop(const Memory &memory, span<const DecodedInstruction> code, uint16_t pc) {
+        const DecodedInstruction &last = code.back();
+        uint16_t target = last.opcode == 0x4C ? last.operand : last.next_pc + static_cast<int8_t>(last.operand);
+        if (polls[last.opcode] != Poll::LOOP || target != pc)
+            return false;
+        for (const DecodedInstruction &instr : code.first(code.size() - 1)) {
+            if (polls[instr.opcode] == Poll::READ) {
+                //Reading PPUSTATUS clears vblank, after which reading it again changes nothing
+                bool ppu_status = instr.operand >= 0x2000 && instr.operand < 0x4000 && (instr.operand & 7) == 2;
+                if (!memory.page_writable(instr.operand >> 8) && !ppu_status)
+                    return false;
+            } else if (polls[instr.opcode] != Poll::REGISTERS) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+BlockCache::Block *BlockCache::find(const Memory &memory, uint16_t pc) {
+    const uint8_t *page = memory.read_page(pc >> 8);
+    if (!page)
+        return nullptr;
+    if (entry_points.empty()) {
+        entry_points.assign(0x10000, 0);
+        //Sized once, so a block in use is never moved by decoding the next one
+        instructions.reserve(CAPACITY);
+        code_bytes.reserve(CAPACITY * 3);
+    }
+    //Walk the blocks decoded at pc, one per bank that was mapped there
+    uint32_t *link = &entry_points[pc];
+    while (*link) {
+        Block &block = blocks[*link - 1];
+        if (block.page == page) {
+            if (!block.verify || unchanged(block, pc))
+                return &block;
+            //RAM code that was rewritten: the old block is of no further use
+            *link = block.previous;
+            break;
+        }
+        link = &block.previous;
+    }
+    uint32_t id = decode(memory, pc, page);
+    return id ? &blocks[id - 1] : nullptr;
+}
+
+void BlockCache::clear() {
+    fill(entry_points.begin(), entry_points.end(), 0);
+    blocks.clear();
+    instructions.clear();
+    code_bytes.clear();
+    clears++;
+}
+
+span<const DecodedInstruction> BlockCache::code(const Block &block) const {
+    return {instructions.data() + block.first, block.length};
+}
+
+bool BlockCache::unchanged(const Block &block, uint16_t pc) const {
+    return memcmp(block.page + (pc & 0xFF), code_bytes.data() + block.bytes, block.code_size) == 0;
+}
+
+uint32_t BlockCache::decode(const Memory &memory, uint16_t pc, const uint8_t *page) {
+    if (instructions.size() + MAX_BLOCK_LENGTH > CAPACITY)
+        clear();
+    Block block = {page, static_cast<uint32_t>(instructions.size()), static_cast<uint32_t>(code_bytes.size()),
+                   0, 0, memory.page_writable(pc >> 8), entry_points[pc], 0, nullptr, false};
+    int offset = pc & 0xFF;
+    while (block.length < MAX_BLOCK_LENGTH) {
+        uint8_t opcode = page[offset];
+        const OpcodeInfo &info = opcodes[opcode];
+        //The rest of the instruction could be on another bank, or not be memory at all
+        if (offset + info.length > 0x100)
+            break;
+        uint16_t operand = 0;
+        if (info.length > 1)
+            operand = page[offset + 1];
+        if (info.length > 2)
+            operand |= page[offset + 2] << 8;
+        offset += info.length;
+        uint16_t next_pc = (pc & 0xFF00) + offset;
+        instructions.push_back({info.replay, operand, next_pc, opcode});
+        block.length++;
+        if (info.ends_block || !keeps_code(memory, page, info.writes, operand))
+            break;
+    }
+    if (block.length == 0)
+        return 0;
+    for (size_t i = block.first; i < instructions.size(); i++)
+        instructions[i].fusion = match_fusion(memory, span(instructions).subspan(i));
+    block.code_size = offset - (pc & 0xFF);
+    block.idle_loop = is_idle_loop(memory, span(instructions).subspan(block.first), pc);
+    if (block.verify)
+        code_bytes.insert(code_bytes.end(), page + (pc & 0xFF), page + offset);
+    blocks.push_back(block);
+    decoded++;
+    entry_points[pc] = static_cast<uint32_t>(blocks.size());
+    return entry_points[pc];
+}
@@ -0,0 +1,88 @@
+#ifndef NESEMULATOR_BLOCK_CACHE_H
+#define NESEMULATOR_BLOCK_CACHE_H
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "instructions.h"
+#include "state.h"
+
+//Code decoded once and replayed from then on (CpuMode::BLOCK_CACHED), so running it no
+//longer fetches opcode and operand bytes through the bus. A block is a straight run of
+//instructions within one page, starting at the PC it was entered at and ending after the
+//first one that jumps, branches, calls or returns, or that may write somewhere other than
+//RAM apart from the block's own code.
+//
+//A block is checked each time it's entered. Its page must still read from the bytes it was
+//decoded from, which catches mapper bank switches, and a block decoded from RAM keeps a
+//copy of its code that must still match. As blocks end at every write that could change
+//them (a store into the code, or to a mapper register), the change is seen from the very
+//next instruction.
+//
+//Decoding also marks the idioms that can be replayed by one fused handler (see fusion.h),
+//and the polling loops whose passes can be skipped over (Block::idle_loop).
+class BlockCache {
+public:
+    //Longest block, in instructions
+    static constexpr int MAX_BLOCK_LENGTH = 32;
+    //Decoded instructions held before everything is dropped and decoding starts over
+    static constexpr size_t CAPACITY = 0x10000;
+
+    struct Block {
+        //The page's read pointer when the block was decoded
+        const uint8_t *page;
+        //Into instructions, and into code_bytes for RAM blocks
+        uint32_t first;
+        uint32_t bytes;
+        uint16_t length;
+        uint16_t code_size;
+        //Decoded from RAM: the code bytes are compared on entry
+        bool verify;
+        //Earlier block at the same PC, for another bank (index + 1, 0 for none)
+        uint32_t previous;
+        //Left to whoever runs the block (see jit.h): times entered, and its native code
+        uint32_t entries;
+        const void *compiled;
+        //Branches back to its own start, and reads nothing that changes but through a
+        //scheduled event: RAM, which it doesn't write, and PPUSTATUS. Once a pass leaves the
+        //CPU as it found it, every further pass does too until the next event or interrupt.
+        bool idle_loop;
+    };
+
+    //The block starting at pc, decoded now if it's new or stale; valid until the next call.
+    //Null when the code can't be cached: an MMIO page, or an instruction running over the
+    //end of its page.
+    Block *find(const Memory &memory, uint16_t pc);
+
+    [[nodiscard]] std::span<const DecodedInstruction> code(const Block &block) const;
+
+    //Drops every block; needed when memory that blocks were decoded from is freed
+    void clear();
+
+    //Times every block was dropped, by clear() or by decoding into a full cache; whatever
+    //was kept for the blocks before (native code) is dead after a change
+    [[nodiscard]] uint64_t generation() const {
+        return clears;
+    }
+
+    //Blocks decoded so far, stale ones included; for profiling
+    [[nodiscard]] uint64_t decoded_count() const {
+        return decoded;
+    }
+
+private:
+    [[nodiscard]] bool unchanged(const Block &block, uint16_t pc) const;
+
+    //Appends a new block for pc; returns its index + 1, or 0 when nothing could be decoded
+    uint32_t decode(const Memory &memory, uint16_t pc, const uint8_t *page);
+
+    //Block index + 1 of the latest block for each PC, 0 for none; allocated on first use
+    std::vector<uint32_t> entry_points;
+    std::vector<Block> blocks;
+    std::vector<DecodedInstruction> instructions;
+    std::vector<uint8_t> code_bytes;
+    uint64_t decoded = 0;
+    uint64_t clears = 0;
+};
+
+#endif //NESEMULATOR_BLOCK_CACHE_H
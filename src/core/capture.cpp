@@ -0,0 +1,209 @@
+#include "capture.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include "ppu.h"
+
+using namespace std;
+
+namespace {
+    constexpr size_t FRAME_PIXELS = SCREEN_WIDTH * SCREEN_HEIGHT;
+
+    //89341.5 dots per frame on average, with the odd frame skip
+    constexpr const char *Y4M_HEADER = "YUV4MPEG2 W256 H240 F10738638:178683 Ip A1:1 C444\n";
+
+    //NES_PALETTE_RGBA as BT.601 limited-range Y, Cb, Cr
+    array<array<uint8_t, 3>, 64> yuv_palette() {
+        array<array<uint8_t, 3>, 64> table;
+        for (int i = 0; i < 64; i++) {
+            double r = NES_PALETTE_RGBA[i] & 0xFF;
+            double g = (NES_PALETTE_RGBA[i] >> 8) & 0xFF;
+            double b = (NES_PALETTE_RGBA[i] >> 16) & 0xFF;
+            table[i][0] = static_cast<uint8_t>(16.5 + (65.738 * r + 129.057 * g + 25.064 * b) / 256);
+            table[i][1] = static_cast<uint8_t>(128.5 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256);
+            table[i][2] = static_cast<uint8_t>(128.5 + (112.439 * r - 94.154 * g - 18.285 * b) / 256);
+        }
+        return table;
+    }
+
+    void put_le(uint8_t *out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+CaptureRing::CaptureRing(size_t slots, size_t slot_size)
+        : slot_count(slots), size_per_slot(slot_size), storage(slots * slot_size), sizes(slots) {
+}
+
+uint8_t *CaptureRing::acquire() {
+    uint64_t next = head.load(memory_order_relaxed);
+    uint64_t done = tail.load(memory_order_acquire);
+    while (next - done >= slot_count) {
+        tail.wait(done, memory_order_acquire);
+        done = tail.load(memory_order_acquire);
+    }
+    return storage.data() + (next % slot_count) * size_per_slot;
+}
+
+void CaptureRing::commit(size_t size) {
+    uint64_t next = head.load(memory_order_relaxed);
+    sizes[next % slot_count] = size;
+    head.store(next + 1, memory_order_release);
+}
+
+const uint8_t *CaptureRing::front(size_t &size) const {
+    uint64_t first = tail.load(memory_order_relaxed);
+    if (first == head.load(memory_order_acquire))
+        return nullptr;
+    size = sizes[first % slot_count];
+    return storage.data() + (first % slot_count) * size_per_slot;
+}
+
+void CaptureRing::pop() {
+    tail.fetch_add(1, memory_order_release);
+    tail.notify_one();
+}
+
+Capture::Capture(const string &video_path, const string &audio_path, int sample_rate)
+        : rate(sample_rate), frames(FRAME_SLOTS, FRAME_PIXELS), samples(SAMPLE_SLOTS, SAMPLES_PER_SLOT * sizeof(int16_t)) {
+    if (!video_path.empty())
+        video = open_output(video_path);
+    if (!audio_path.empty()) {
+        try {
+            audio = open_output(audio_path);
+        } catch (...) {
+            if (video)
+                fclose(video);
+            throw;
+        }
+    }
+    if (video)
+        fputs(Y4M_HEADER, video);
+    if (audio)
+        write_wav_header(UINT32_MAX);
+    writer = thread(&Capture::run, this);
+}
+
+Capture::~Capture() {
+    stopping.store(true, memory_order_release);
+    post();
+    writer.join();
+    if (audio) {
+        //Pipes keep the streaming header; seekable files get the real sizes
+        if (fseek(audio, 0, SEEK_SET) == 0)
+            write_wav_header(static_cast<uint32_t>(min<uint64_t>(sample_bytes, UINT32_MAX - 36)));
+        fclose(audio);
+    }
+    if (video)
+        fclose(video);
+}
+
+FILE *Capture::open_output(const string &path) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        throw runtime_error("Capture: can't open " + path + ": " + strerror(errno));
+    return file;
+}
+
+void Capture::write_wav_header(uint32_t data_size) {
+    array<uint8_t, 44> header = {};
+    memcpy(header.data(), "RIFF", 4);
+    put_le(header.data() + 4, data_size == UINT32_MAX ? UINT32_MAX : data_size + 36, 4);
+    memcpy(header.data() + 8, "WAVEfmt ", 8);
+    put_le(header.data() + 16, 16, 4);
+    put_le(header.data() + 20, 1, 2); // PCM
+    put_le(header.data() + 22, 1, 2); // mono
+    put_le(header.data() + 24, rate, 4);
+    put_le(header.data() + 28, rate * sizeof(int16_t), 4);
+    put_le(header.data() + 32, sizeof(int16_t), 2);
+    put_le(header.data() + 34, 16, 2);
+    memcpy(header.data() + 36, "data", 4);
+    put_le(header.data() + 40, data_size, 4);
+    fwrite(header.data(), 1, header.size(), audio);
+}
+
+void Capture::push_frame(const uint8_t *pixels) {
+    if (!video)
+        return;
+    //The slot stays the one lent until it's committed
+    uint8_t *slot = frames.acquire();
+    if (pixels != slot)
+        memcpy(slot, pixels, FRAME_PIXELS);
+    frames.commit(FRAME_PIXELS);
+    post();
+}
+
+void Capture::push_samples(const int16_t *data, size_t count) {
+    if (!audio)
+        return;
+    if (data == reinterpret_cast<const int16_t *>(samples.acquire())) {
+        samples.commit(count * sizeof(int16_t));
+        count = 0;
+    }
+    while (count > 0) {
+        size_t n = min(count, SAMPLES_PER_SLOT);
+        memcpy(samples.acquire(), data, n * sizeof(int16_t));
+        samples.commit(n * sizeof(int16_t));
+        data += n;
+        count -= n;
+    }
+    post();
+}
+
+uint8_t *Capture::frame_target(void *context) {
+    auto *capture = static_cast<Capture *>(context);
+    return capture->video ? capture->frames.acquire() : nullptr;
+}
+
+int16_t *Capture::sample_target(void *context, size_t count) {
+    auto *capture = static_cast<Capture *>(context);
+    if (!capture->audio || count > SAMPLES_PER_SLOT)
+        return nullptr;
+    return reinterpret_cast<int16_t *>(capture->samples.acquire());
+}
+
+void Capture::frame_callback(void *context, const uint8_t *pixels, uint64_t frame) {
+    static_cast<Capture *>(context)->push_frame(pixels);
+}
+
+void Capture::sample_callback(void *context, const int16_t *data, size_t count) {
+    static_cast<Capture *>(context)->push_samples(data, count);
+}
+
+void Capture::post() {
+    posted.fetch_add(1, memory_order_release);
+    posted.notify_one();
+}
+
+void Capture::run() {
+    static const array<array<uint8_t, 3>, 64> yuv = yuv_palette();
+    vector<uint8_t> planes(3 * FRAME_PIXELS);
+    while (true) {
+        uint64_t seen = posted.load(memory_order_acquire);
+        //Read first: everything committed before the stop request gets drained below
+        bool stop = stopping.load(memory_order_acquire);
+        size_t size;
+        while (const uint8_t *pixels = frames.front(size)) {
+            for (size_t i = 0; i < FRAME_PIXELS; i++) {
+                const array<uint8_t, 3> &color = yuv[pixels[i] & 0x3F];
+                planes[i] = color[0];
+                planes[FRAME_PIXELS + i] = color[1];
+                planes[2 * FRAME_PIXELS + i] = color[2];
+            }
+            frames.pop();
+            if (fputs("FRAME\n", video) < 0 || fwrite(planes.data(), 1, planes.size(), video) != planes.size())
+                write_error.store(true, memory_order_relaxed);
+        }
+        while (const uint8_t *data = samples.front(size)) {
+            if (fwrite(data, 1, size, audio) != size)
+                write_error.store(true, memory_order_relaxed);
+            sample_bytes += size;
+            samples.pop();
+        }
+        if (stop)
+            return;
+        posted.wait(seen, memory_order_acquire);
+    }
+}
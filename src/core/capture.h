@@ -0,0 +1,115 @@
+#ifndef NESEMULATOR_CAPTURE_H
+#define NESEMULATOR_CAPTURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Fixed slots handed from one producer thread to the capture writer. The producer fills
+//the slot acquire() returns in place and publishes it with commit(); nothing is allocated
+//after construction.
+class CaptureRing {
+public:
+    CaptureRing(size_t slots, size_t slot_size);
+
+    //The next free slot, blocking while the writer still has all of them
+    uint8_t *acquire();
+
+    //Publishes the acquired slot holding size bytes
+    void commit(size_t size);
+
+    //Writer side: the oldest published slot and its size, or null when there is none
+    [[nodiscard]] const uint8_t *front(size_t &size) const;
+
+    //Writer side: hands the front slot back to the producer
+    void pop();
+
+    [[nodiscard]] size_t slot_size() const {
+        return size_per_slot;
+    }
+
+private:
+    size_t slot_count;
+    size_t size_per_slot;
+    std::vector<uint8_t> storage;
+    std::vector<size_t> sizes;
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+};
+
+//Headless recording: frames to a YUV4MPEG2 stream and samples to a WAV file, either of
+//which can be a regular file or a pipe (a FIFO, /dev/fd/N). Frames and samples go through
+//rings of preallocated slots and a writer thread does the color conversion and all the
+//I/O, so the emulation only stalls if the writer falls a whole ring behind. Lent out as
+//frame and sample targets, the slots are drawn and mixed into directly, and pushing them
+//back only publishes them.
+//
+//Frames and samples may come from different threads (the render thread and the CPU
+//thread), but each from only one.
+class Capture {
+public:
+    //An empty path leaves that stream out
+    Capture(const std::string &video_path, const std::string &audio_path, int sample_rate);
+
+    //Drains the rings and finishes the files
+    ~Capture();
+
+    Capture(const Capture &) = delete;
+
+    Capture &operator=(const Capture &) = delete;
+
+    //A frame of palette indices (0-63), SCREEN_WIDTH * SCREEN_HEIGHT of them. Copied unless
+    //it's the slot frame_target lent.
+    void push_frame(const uint8_t *pixels);
+
+    //Copied unless it's the slot sample_target lent
+    void push_samples(const int16_t *samples, size_t count);
+
+    //Matches FrameTarget, with the Capture as context: the next free frame slot
+    static uint8_t *frame_target(void *context);
+
+    //Matches SampleTarget, with the Capture as context: the next free sample slot, if count fits
+    static int16_t *sample_target(void *context, size_t count);
+
+    //Matches FrameCallback, with the Capture as context
+    static void frame_callback(void *context, const uint8_t *pixels, uint64_t frame);
+
+    //Matches SampleCallback, with the Capture as context
+    static void sample_callback(void *context, const int16_t *samples, size_t count);
+
+    //True once a write has failed, e.g. the reading end of a pipe went away
+    [[nodiscard]] bool failed() const {
+        return write_error.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t FRAME_SLOTS = 8;
+    static constexpr size_t SAMPLE_SLOTS = 16;
+    //Over a frame's batch at 96kHz, so batches fit in one slot
+    static constexpr size_t SAMPLES_PER_SLOT = 2048;
+
+    static FILE *open_output(const std::string &path);
+
+    void write_wav_header(uint32_t data_size);
+
+    //Wakes the writer after a commit
+    void post();
+
+    void run();
+
+    FILE *video = nullptr;
+    FILE *audio = nullptr;
+    int rate;
+    uint64_t sample_bytes = 0;
+    CaptureRing frames;
+    CaptureRing samples;
+    alignas(64) std::atomic<uint64_t> posted = 0;
+    std::atomic<bool> stopping = false;
+    std::atomic<bool> write_error = false;
+    std::thread writer;
+};
+
+#endif //NESEMULATOR_CAPTURE_H
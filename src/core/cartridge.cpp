@@ -0,0 +1,127 @@
+#include "cartridge.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NESEMULATOR_HAS_MMAP 1
+#endif
+
+using namespace std;
+
+shared_ptr<const Cartridge> Cartridge::open(const string &path) {
+    static mutex cache_mutex;
+    static map<string, weak_ptr<const Cartridge>> cache;
+
+    string key = filesystem::weakly_canonical(path).string();
+    auto open_already = [&key]() -> shared_ptr<const Cartridge> {
+        auto found = cache.find(key);
+        if (found == cache.end())
+            return nullptr;
+        if (auto existing = found->second.lock())
+            return existing;
+        cache.erase(found);
+        return nullptr;
+    };
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        if (auto existing = open_already())
+            return existing;
+    }
+
+    //Mapped and parsed unlocked, so loads of other ROMs don't wait on this one
+    shared_ptr<const Cartridge> cartridge = load(path);
+    lock_guard<mutex> lock(cache_mutex);
+    //Whoever got the same ROM in first meanwhile is shared, and this copy dropped
+    if (auto existing = open_already())
+        return existing;
+    //Other closed ROMs go too, so the map only ever holds the ROMs open at once
+    erase_if(cache, [](const auto &entry) { return entry.second.expired(); });
+    cache[key] = cartridge;
+    return cartridge;
+}
+
+shared_ptr<Cartridge> Cartridge::load(const string &path) {
+    shared_ptr<Cartridge> cartridge(new Cartridge());
+#ifdef NESEMULATOR_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Can't open ROM " + path);
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw runtime_error("Can't read ROM " + path);
+    }
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw runtime_error("Can't map ROM " + path);
+    cartridge->mapping = mapping;
+    cartridge->mapping_size = info.st_size;
+    cartridge->parse(static_cast<const uint8_t *>(mapping), info.st_size);
+#else
+    ifstream stream(path, ios::binary);
+    if (!stream.is_open())
+        throw runtime_error("Can't open ROM " + path);
+    cartridge->owned.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    cartridge->parse(cartridge->owned.data(), cartridge->owned.size());
+#endif
+    return cartridge;
+}
+
+shared_ptr<const Cartridge> Cartridge::read(istream &stream) {
+    shared_ptr<Cartridge> cartridge(new Cartridge());
+    cartridge->owned.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    cartridge->parse(cartridge->owned.data(), cartridge->owned.size());
+    return cartridge;
+}
+
+Cartridge::~Cartridge() {
+#ifdef NESEMULATOR_HAS_MMAP
+    if (mapping)
+        munmap(mapping, mapping_size);
+#endif
+}
+
+void Cartridge::parse(const uint8_t *data, size_t size) {
+    if (size < 16)
+        throw invalid_argument("ROM doesn't contain a header.");
+    if (data[0] != 'N' || data[1] != 'E' || data[2] != 'S' || data[3] != 0x1A)
+        throw invalid_argument("ROM isn't in iNES format.");
+    size_t prg_rom_size = 16384 * data[4];
+    size_t chr_rom_size = 8192 * data[5];
+    bool trainer = data[6] & 0x04;
+
+    const size_t prg_rom_start = 16 + (trainer ? 512 : 0);
+    const size_t prg_rom_end = prg_rom_start + prg_rom_size;
+    const size_t chr_rom_end = prg_rom_end + chr_rom_size;
+
+    if (size < chr_rom_end || prg_rom_size == 0)
+        throw runtime_error("ROM file size does not match header information");
+
+    prg_rom = {data + prg_rom_start, prg_rom_size};
+    chr_rom = {data + prg_rom_end, chr_rom_size};
+    //Old dumps sometimes have junk in bytes 7-15; only trust byte 7 when the tail is clean or it's NES 2.0
+    bool nes2 = (data[7] & 0x0C) == 0x08;
+    bool clean_tail = !data[12] && !data[13] && !data[14] && !data[15];
+    uint8_t mapper_high = nes2 || clean_tail ? data[7] & 0xF0 : 0;
+    mapper_number = mapper_high | (data[6] >> 4);
+    if (data[6] & 0x08)
+        mirroring = Mirroring::FOUR_SCREEN;
+    else
+        mirroring = data[6] & 0x01 ? Mirroring::VERTICAL : Mirroring::HORIZONTAL;
+    battery = data[6] & 0x02;
+    //PRG-RAM is only allocated for boards that normally carry it
+    int prg_ram_banks = nes2 ? 0 : data[8];
+    if (prg_ram_banks || battery || mapper_number == 1 || mapper_number == 4)
+        prg_ram_size = 0x2000 * max(prg_ram_banks, 1);
+}
@@ -0,0 +1,56 @@
+#ifndef NESEMULATOR_CARTRIDGE_H
+#define NESEMULATOR_CARTRIDGE_H
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+enum class Mirroring {
+    HORIZONTAL,
+    VERTICAL,
+    SINGLE_SCREEN_LOW,
+    SINGLE_SCREEN_HIGH,
+    FOUR_SCREEN
+};
+
+//A read-only iNES image. The header is validated where it lies and prg_rom/chr_rom point
+//straight into the image, so mappers can bank directly out of it. Cartridges are immutable
+//and meant to be shared between any number of emulator instances.
+class Cartridge {
+public:
+    //mmaps the file read-only; opening a path that is already open returns the same mapping
+    static std::shared_ptr<const Cartridge> open(const std::string &path);
+
+    //Copies the image out of a stream
+    static std::shared_ptr<const Cartridge> read(std::istream &stream);
+
+    ~Cartridge();
+
+    Cartridge(const Cartridge &) = delete;
+
+    Cartridge &operator=(const Cartridge &) = delete;
+
+    std::span<const uint8_t> prg_rom;
+    std::span<const uint8_t> chr_rom; //empty when the board has CHR-RAM instead
+    uint16_t mapper_number = 0;
+    Mirroring mirroring = Mirroring::HORIZONTAL;
+    bool battery = false;
+    uint32_t prg_ram_size = 0;
+
+private:
+    Cartridge() = default;
+
+    //open() without the cache
+    static std::shared_ptr<Cartridge> load(const std::string &path);
+
+    void parse(const uint8_t *data, size_t size);
+
+    std::vector<uint8_t> owned;
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+};
+
+#endif //NESEMULATOR_CARTRIDGE_H
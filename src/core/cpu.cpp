@@ -2,18 +2,103 @@
 
 #include "state.h"
 #include "instructions.h"
+#include "mapper.h"
+#include "micro_ops.h"
+#include "scheduler.h"
+#include "ppu.h"
+#include "apu.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "precompiled.h"
+#include "fusion.h"
 #include <vector>
 #include <iostream>
 
 using namespace std;
 
 
+enum class CpuMode {
+    //Each instruction does all of its bus accesses on its first cycle, then idles
+    INSTRUCTION_STEPPED,
+    //Each cycle does exactly the bus access the 6502 does on it (see micro_ops.h)
+    CYCLE_STEPPED,
+    //As INSTRUCTION_STEPPED, but run_until replays code decoded once into blocks (see
+    //block_cache.h) rather than fetching it again; posedge_clock still fetches
+    BLOCK_CACHED,
+    //As BLOCK_CACHED, with the blocks entered often compiled to native code (see jit.h).
+    //Where there's no JIT (not x86-64, or no executable memory) it is BLOCK_CACHED.
+    JIT,
+    //As BLOCK_CACHED, with the code of the loaded ROM that was compiled ahead of time (see
+    //precompiled.h and Cpu6502::set_precompiled) run wherever it has a block for PC
+    PRECOMPILED
+};
+
+//The stop predicate of runs that only end at their deadline
+struct NeverStop {
+    bool operator()(Cpu6502_State &) const {
+        return false;
+    }
+};
+
+//Passes through an idle loop (BlockCache::Block::idle_loop) entered back to back, each
+//leaving the registers as it found them
+struct IdlePasses {
+    const BlockCache::Block *block = nullptr;
+    array<uint8_t, 5> regs = {};
+    int64_t budget = 0;
+    int count = 0;
+
+    //Called as an idle loop is entered with budget left. Once two passes in a row changed
+    //nothing (the first may still have cleared vblank) the loop can only ever do the same
+    //again; returns the cycles of a pass from then on, 0 before.
+    int64_t enter(const BlockCache::Block *entered, const Reg &reg, int64_t left) {
+        array<uint8_t, 5> now = {reg.getA().val, reg.getX().val, reg.getY().val, reg.getP().val, reg.getS().val};
+        int64_t pass = budget - left;
+        budget = left;
+        if (entered != block || now != regs) {
+            block = entered;
+            regs = now;
+            count = 0;
+            return 0;
+        }
+        return ++count >= 2 ? pass : 0;
+    }
+};
+
+//Registers and flat RAM to come back to, see Cpu6502::snapshot()
+struct CpuSnapshot {
+    Reg reg;
+    InterruptLines lines;
+    uint64_t clock = 0;
+    vector<uint8_t> ram;
+};
+
 class Cpu6502 {
 private:
     uint8_t _instr_ = 0x00;
     int _cycle_ct_ = 0x00;
+    //DMA stall cycles left to sit out, cycle-stepped
+    uint32_t _stall_ct_ = 0;
+    //Kept at the start of the running instruction, so peripherals can timestamp bus accesses
+    uint64_t _clock_ = 0;
+    CpuMode _mode_;
+    MicroOpCpu _micro_;
+    BlockCache _blocks_;
+    Jit _jit_;
+    const PrecompiledRom *_precompiled_ = nullptr;
+    array<uint64_t, FUSION_COUNT> _fusions_run_ = {};
+    uint64_t _idle_cycles_ = 0;
+    Scheduler _scheduler_;
     Cpu6502_State state;
+    unique_ptr<Mapper> _mapper_;
+    //Declared after the mapper it reads CHR through, so it goes first
+    unique_ptr<Ppu> _ppu_;
+    unique_ptr<Apu> _apu_;
+    bool _threaded_ppu_ = false;
+    bool _frame_rendering_ = true;
 public:
+    explicit Cpu6502(CpuMode mode = CpuMode::INSTRUCTION_STEPPED) : _mode_(mode) {}
+
     void power() {
         state.reg().setA(Val(0));
         state.reg().setX(Val(0));
@@ -29,6 +114,15 @@ public:
     }
 
     void reset() {
+        _micro_.reset();
+        _cycle_ct_ = 0;
+        _stall_ct_ = 0;
+        _scheduler_.take_stall(0);
+        state.interrupts().nmi = false;
+        if (_ppu_)
+            _ppu_->reset();
+        if (_apu_)
+            _apu_->reset();
         state.reg().set_flag(FlagPositions::INTERRUPT_DISABLE, true);
         state.reg().setS(state.reg().getS() - Val(3));
         uint8_t low = state.mem().read_byte(0xFFFC);
@@ -38,44 +132,194 @@ public:
     }
 
     void posedge_clock() {
+        if (_clock_ >= _scheduler_.next_time())
+            _scheduler_.run_due(_clock_);
+        if (_mode_ == CpuMode::CYCLE_STEPPED) {
+            if (!stall_cycle())
+                _micro_.step(state);
+            _clock_++;
+            return;
+        }
+        if (_cycle_ct_ == 0 && state.interrupts().any())
+            _cycle_ct_ = service_interrupt(state);
         if (_cycle_ct_ == 0) {
             _instr_ = state.get_byte(state.reg().getPC()).val;
             state.reg().incrPC();
-            _cycle_ct_ = instructions[_instr_]->act(state);
+            _cycle_ct_ = instructions[_instr_](state);
         }
+        _cycle_ct_ += static_cast<int>(_scheduler_.take_stall(_clock_ + _cycle_ct_));
         _cycle_ct_--;
+        _clock_++;
     }
 
-    void load_rom(istream &stream) {
-        vector<char> rom_data((istreambuf_iterator<char>(stream)), istreambuf_iterator<char>());
+    //Same as n calls to posedge_clock, but whole instructions run back to back. The last
+    //instruction may end past n; the cycles it overshot are returned, and are also what
+    //posedge_clock/run_cycles will idle through before fetching again.
+    int run_cycles(int n) {
+        return run_until(_clock_ + n, NeverStop());
+    }
 
-        if (rom_data.size() < 16)
-            throw invalid_argument("ROM doesn't contain a header.");
-        int prg_rom_size = 16384 * rom_data[4];
-        int chr_rom_size = 8192 * rom_data[5];
+    //Runs whole instructions until the clock reaches deadline, or until stop(state) holds
+    //after an instruction. Returns the cycles overshot past deadline (0 when stopped early).
+    //In CYCLE_STEPPED mode the clock stops exactly at the deadline, mid-instruction if need be.
+    //Scheduled events fire at the first instruction boundary at or after their timestamp;
+    //between events nothing but the interrupt lines is looked at.
+    template<class Predicate>
+    int run_until(uint64_t deadline, Predicate stop) {
+        if (deadline <= _clock_)
+            return 0;
+        if (_mode_ == CpuMode::CYCLE_STEPPED) {
+            while (_clock_ < deadline) {
+                if (_clock_ >= _scheduler_.next_time())
+                    _scheduler_.run_due(_clock_);
+                if (!stall_cycle())
+                    _micro_.step(state);
+                _clock_++;
+                if (at_instruction_boundary() && stop(state))
+                    break;
+            }
+            return 0;
+        }
+        if (_mode_ == CpuMode::BLOCK_CACHED)
+            return run_instructions<CpuMode::BLOCK_CACHED>(deadline, stop);
+        if (_mode_ == CpuMode::JIT)
+            return run_instructions<CpuMode::JIT>(deadline, stop);
+        if (_mode_ == CpuMode::PRECOMPILED)
+            return run_instructions<CpuMode::PRECOMPILED>(deadline, stop);
+        return run_instructions<CpuMode::INSTRUCTION_STEPPED>(deadline, stop);
+    }
 
-        const int prg_rom_start = 16;
-        const int prg_rom_end = prg_rom_start + prg_rom_size;
+    //Captures the registers and the flat RAM (see Memory::map_flat) and starts tracking
+    //writes afresh, so reset_to() only has to restore what changes after this
+    CpuSnapshot snapshot() {
+        if (state.mem().flat().empty())
+            throw logic_error("Cpu6502: snapshots need flat RAM");
+        CpuSnapshot snap;
+        snap.reg = state.reg();
+        snap.lines = state.interrupts();
+        snap.clock = _clock_;
+        snap.ram.assign(state.mem().flat().begin(), state.mem().flat().end());
+        state.mem().clear_touched();
+        return snap;
+    }
 
-        size_t expected_size = 16 + prg_rom_size + (chr_rom_size ? chr_rom_size : 0);
-        if (rom_data.size() < expected_size) {
-            throw std::runtime_error("ROM file size does not match header information");
-        }
+    //Back to snap, which must be the last snapshot taken (or have the same RAM); only the
+    //pages written since then are copied back. Cheaper than a new Cpu6502 for the many
+    //short runs of a test harness.
+    void reset_to(const CpuSnapshot &snap) {
+        state.mem().restore_touched(snap.ram.data());
+        state.reg() = snap.reg;
+        state.interrupts() = snap.lines;
+        _clock_ = snap.clock;
+        _cycle_ct_ = 0;
+        _stall_ct_ = 0;
+        _scheduler_.take_stall(0);
+        _instr_ = 0;
+        _micro_.reset();
+    }
 
-        if (prg_rom_size == 0x4000) {
-            for (int i = 0; i < prg_rom_end - prg_rom_start; i++) {
-                state.mem().write_byte(0x8000 + i, rom_data[prg_rom_start + i]);
-                state.mem().write_byte(0xC000 + i, rom_data[prg_rom_start + i]);
-            }
-        } else {
-            for (int i = 0; i < prg_rom_end - prg_rom_start; i++) {
-                state.mem().write_byte(0x8000 + i, rom_data[prg_rom_start + i]);
-            }
-        }
+    //Cycles elapsed since construction
+    [[nodiscard]] uint64_t cycles() const {
+        return _clock_;
+    }
+
+    //True when the next clock starts a new instruction
+    [[nodiscard]] bool at_instruction_boundary() const {
+        if (_mode_ == CpuMode::CYCLE_STEPPED)
+            return _micro_.at_instruction_boundary() && _stall_ct_ == 0 && _scheduler_.pending_stall() == 0;
+        return _cycle_ct_ == 0;
+    }
+
+    void load_rom(istream &stream) {
+        load_rom(Cartridge::read(stream));
+    }
+
+    //Instances loading the same path share one read-only mapping of it
+    void load_rom(const string &path) {
+        load_rom(Cartridge::open(path));
+    }
+
+    void load_rom(shared_ptr<const Cartridge> cartridge) {
+        _apu_.reset();
+        _ppu_.reset();
+        _scheduler_ = Scheduler();
+        //Blocks point into the old cartridge's banks, which the new one may be given
+        _blocks_.clear();
+        _jit_.reset();
+        _precompiled_ = nullptr;
+        state.mem().map_nes();
+        _mapper_ = create_mapper(std::move(cartridge));
+        _mapper_->attach(state.mem(), _clock_);
+        _mapper_->connect_irq(state.interrupts());
+        _ppu_ = make_unique<Ppu>(*_mapper_, _threaded_ppu_);
+        _ppu_->attach(state.mem(), _scheduler_, state.interrupts(), _clock_);
+        _ppu_->set_frame_rendering(_frame_rendering_);
+        _apu_ = make_unique<Apu>();
+        _apu_->attach(state.mem(), _scheduler_, state.interrupts(), _clock_);
 
         std::cout << "ROM loaded successfully" << std::endl;
     }
 
+    //Peripherals post their events here, timestamped in CPU cycles (see cycles())
+    Scheduler &scheduler() {
+        return _scheduler_;
+    }
+
+    //Draw frames on a render thread instead of inline; applies from the next load_rom
+    void set_threaded_ppu(bool threaded) {
+        _threaded_ppu_ = threaded;
+    }
+
+    //Fast-forward switch: with rendering off frames are timed but not drawn (see
+    //Ppu::set_frame_rendering). Applies from the next frame and survives load_rom.
+    void set_frame_rendering(bool enabled) {
+        _frame_rendering_ = enabled;
+        if (_ppu_)
+            _ppu_->set_frame_rendering(enabled);
+    }
+
+    Ppu *ppu() {
+        return _ppu_.get();
+    }
+
+    Apu *apu() {
+        return _apu_.get();
+    }
+
+    //Compiler settings and counters for CpuMode::JIT
+    Jit &jit() {
+        return _jit_;
+    }
+
+    //Code compiled ahead of time for the loaded ROM, run in CpuMode::PRECOMPILED until the
+    //next load_rom. Returns false, leaving it out, unless it was compiled from this very
+    //NROM image.
+    bool set_precompiled(const PrecompiledRom *rom) {
+        _precompiled_ = nullptr;
+        if (!rom || !_mapper_)
+            return false;
+        const Cartridge &cartridge = _mapper_->cartridge();
+        if (cartridge.mapper_number != 0 || cartridge.prg_rom.size() != rom->prg_size ||
+            prg_rom_hash(cartridge.prg_rom) != rom->prg_hash)
+            return false;
+        _precompiled_ = rom;
+        return true;
+    }
+
+    //Times each fused idiom (see fusion.h) ran as one, indexed like fusions
+    [[nodiscard]] const array<uint64_t, FUSION_COUNT> &fusion_counts() const {
+        return _fusions_run_;
+    }
+
+    //Cycles skipped over in idle loops rather than run (see BlockCache::Block::idle_loop)
+    [[nodiscard]] uint64_t idle_cycles() const {
+        return _idle_cycles_;
+    }
+
+    Mapper *mapper() {
+        return _mapper_.get();
+    }
+
     Reg &reg() {
         return state.reg();
     }
@@ -87,4 +331,166 @@ public:
     Cpu6502_State& cpu_state() {
         return state;
     }
+
+private:
+    //run_until for whole instructions: fetched through the bus, replayed from blocks, or run
+    //as native or precompiled code
+    template<CpuMode mode, class Predicate>
+    int run_instructions(uint64_t deadline, Predicate stop) {
+        //The loop only touches locals, apart from keeping _clock_ for the peripherals; the
+        //counters are written back once at the end
+        Cpu6502_State &cs = state;
+        const InterruptLines &lines = cs.interrupts();
+        const array<Instruction, 256> &table = instructions;
+        int64_t budget = static_cast<int64_t>(deadline - _clock_) - _cycle_ct_;
+        int64_t event_budget = next_event_budget(deadline);
+        uint8_t instr = _instr_;
+        bool stopped = false;
+        //What's left of the block being replayed
+        const DecodedInstruction *next = nullptr;
+        const DecodedInstruction *end = nullptr;
+        IdlePasses idle;
+        JitFrame frame = {&cs, &_clock_, &lines, &_scheduler_.pending_stall(), nullptr, nullptr, deadline};
+        if constexpr (!is_same_v<Predicate, NeverStop>) {
+            frame.stop = [](void *context, Cpu6502_State &state) {
+                return static_cast<bool>((*static_cast<Predicate *>(context))(state));
+            };
+            frame.stop_context = &stop;
+        }
+        while (budget > 0) {
+            if (budget <= event_budget) {
+                _scheduler_.run_due(deadline - budget);
+                event_budget = next_event_budget(deadline);
+                idle.block = nullptr;
+                //DMC fetches hold the CPU off the bus; the next instruction waits them out
+                if (_scheduler_.pending_stall()) {
+                    budget -= _scheduler_.take_stall(deadline - budget);
+                    continue;
+                }
+            }
+            if (lines.any()) {
+                int taken = service_interrupt(cs);
+                if (taken) {
+                    budget -= taken;
+                    next = end;
+                    idle.block = nullptr;
+                    continue;
+                }
+            }
+            _clock_ = deadline - budget;
+            if constexpr (mode != CpuMode::INSTRUCTION_STEPPED) {
+                if (next == end) {
+                    if (mode == CpuMode::PRECOMPILED && _precompiled_) {
+                        frame.budget = budget;
+                        frame.event_budget = event_budget;
+                        frame.entry_lines = lines.irq | lines.nmi << 8;
+                        frame.opcode = instr;
+                        bool stop_now = _precompiled_->run(frame);
+                        instr = frame.opcode;
+                        if (stop_now) {
+                            budget = frame.budget - _scheduler_.take_stall(deadline - frame.budget);
+                            stopped = true;
+                            break;
+                        }
+                        //Nothing ran when there's no block for PC; the cache takes it
+                        if (frame.budget != budget) {
+                            budget = frame.budget - _scheduler_.take_stall(deadline - frame.budget);
+                            idle.block = nullptr;
+                            continue;
+                        }
+                    }
+                    if (mode == CpuMode::JIT && _jit_.full()) {
+                        _blocks_.clear();
+                        _jit_.reset();
+                    }
+                    BlockCache::Block *block = _blocks_.find(cs.mem(), cs.reg().getPC().addr);
+                    //Passes of an idle loop that would end before the next event or the
+                    //deadline are skipped, all but their cycles
+                    if (is_same_v<Predicate, NeverStop> && block && block->idle_loop) {
+                        int64_t pass = idle.enter(block, cs.reg(), budget);
+                        int64_t floor = max<int64_t>(event_budget, 0);
+                        if (pass > 0 && budget - pass > floor) {
+                            int64_t skipped = (budget - floor - 1) / pass * pass;
+                            budget -= skipped;
+                            idle.budget = budget;
+                            _idle_cycles_ += skipped;
+                            _clock_ = deadline - budget;
+                        }
+                    } else {
+                        idle.block = nullptr;
+                    }
+                    const void *native = block && mode == CpuMode::JIT ? _jit_.enter(_blocks_, *block) : nullptr;
+                    if (native) {
+                        frame.budget = budget;
+                        frame.event_budget = event_budget;
+                        frame.entry_lines = lines.irq | lines.nmi << 8;
+                        bool stop_now = Jit::run(native, frame);
+                        budget = frame.budget - _scheduler_.take_stall(deadline - frame.budget);
+                        instr = frame.opcode;
+                        if (stop_now) {
+                            stopped = true;
+                            break;
+                        }
+                        continue;
+                    }
+                    if (block) {
+                        span<const DecodedInstruction> code = _blocks_.code(*block);
+                        next = code.data();
+                        end = next + code.size();
+                    }
+                }
+            }
+            if (mode != CpuMode::INSTRUCTION_STEPPED && next != end) {
+                const DecodedInstruction &decoded = *next;
+                const Fusion &fusion = fusions[decoded.fusion];
+                //Fused only when nothing could have happened between its instructions
+                if (is_same_v<Predicate, NeverStop> && decoded.fusion &&
+                    budget - fusion.lead_cycles > max<int64_t>(event_budget, 0)) {
+                    _fusions_run_[decoded.fusion]++;
+                    next += fusion.length;
+                    instr = next[-1].opcode;
+                    budget -= fusion.replay(cs, decoded);
+                } else {
+                    next++;
+                    instr = decoded.opcode;
+                    budget -= decoded.replay(cs, decoded);
+                }
+            } else {
+                instr = cs.get_instr_byte().val;
+                budget -= table[instr](cs);
+            }
+            //OAM DMA, or a DMC fetch the instruction set off, holds the CPU before the next
+            if (_scheduler_.pending_stall())
+                budget -= _scheduler_.take_stall(deadline - budget);
+            if (stop(cs)) {
+                stopped = true;
+                break;
+            }
+        }
+        _instr_ = instr;
+        if (stopped && budget > 0) {
+            _clock_ = deadline - budget;
+            _cycle_ct_ = 0;
+        } else {
+            _clock_ = deadline;
+            _cycle_ct_ = static_cast<int>(-budget);
+        }
+        return _cycle_ct_;
+    }
+
+    //Cycle-stepped, DMA holds the CPU between any two cycles; returns whether this one is held
+    bool stall_cycle() {
+        _stall_ct_ += _scheduler_.take_stall(_clock_);
+        if (_stall_ct_ == 0)
+            return false;
+        _stall_ct_--;
+        return true;
+    }
+
+    //The budget left in run_until when the next event falls due; never reached when the
+    //event lies at or past the deadline
+    [[nodiscard]] int64_t next_event_budget(uint64_t deadline) const {
+        uint64_t next = _scheduler_.next_time();
+        return next < deadline ? static_cast<int64_t>(deadline - next) : INT64_MIN;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "fusion.h"
+#include "handlers.h"
+
+using namespace std;
+
+namespace {
+    template<uint8_t... ops>
+    int replay_fused(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        const DecodedInstruction *next = &instr;
+        int cycles = 0;
+        ((cycles += replay_opcode<ops>(cs, *next++)), ...);
+        return cycles;
+    }
+
+    //The store goes to RAM: no peripheral sees it, so it doesn't matter that the CPU's clock
+    //still reads the start of the load
+    bool stores_to_ram(const Memory &memory, const DecodedInstruction *code) {
+        return memory.page_writable(code[1].operand >> 8);
+    }
+
+    //Reading PPUSTATUS clears vblank and the write toggle, but leaves the NMI line alone
+    bool polls_ppu_status(const Memory &memory, const DecodedInstruction *code) {
+        return code[0].operand == 0x2002;
+    }
+}
+
+const array<Fusion, FUSION_COUNT> fusions = {{
+    {"none", {}, 1, 0, nullptr, nullptr},
+    {"DEX; BNE", {0xCA, 0xD0}, 2, 2, replay_fused<0xCA, 0xD0>, nullptr},
+    {"DEY; BNE", {0x88, 0xD0}, 2, 2, replay_fused<0x88, 0xD0>, nullptr},
+    {"LDA abs; STA abs", {0xAD, 0x8D}, 2, 4, replay_fused<0xAD, 0x8D>, stores_to_ram},
+    {"CMP #imm; BEQ", {0xC9, 0xF0}, 2, 2, replay_fused<0xC9, 0xF0>, nullptr},
+    {"CMP #imm; BNE", {0xC9, 0xD0}, 2, 2, replay_fused<0xC9, 0xD0>, nullptr},
+    {"INY; CPY #imm; BNE", {0xC8, 0xC0, 0xD0}, 3, 4, replay_fused<0xC8, 0xC0, 0xD0>, nullptr},
+    {"BIT $2002; BPL", {0x2C, 0x10}, 2, 4, replay_fused<0x2C, 0x10>, polls_ppu_status},
+}};
+
+uint8_t match_fusion(const Memory &memory, span<const DecodedInstruction> code) {
+    for (size_t id = 1; id < FUSION_COUNT; id++) {
+        const Fusion &fusion = fusions[id];
+        if (fusion.length > code.size())
+            continue;
+        bool same = true;
+        for (size_t i = 0; i < fusion.length; i++)
+            same = same && code[i].opcode == fusion.opcodes[i];
+        if (same && (!fusion.applies || fusion.applies(memory, code.data())))
+            return static_cast<uint8_t>(id);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef NESEMULATOR_FUSION_H
+#define NESEMULATOR_FUSION_H
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include "instructions.h"
+#include "state.h"
+
+//Common idioms of two or three instructions, replayed by one handler when they're found in
+//decoded code (see BlockCache). The handler runs exactly the instructions it stands for, so
+//cycles and flags are those of running them one by one; it just skips the dispatch and the
+//interpreter loop's checks in between. The loop only takes a fused handler when those
+//checks couldn't have caught anything: no stop predicate, and the budget lasting past the
+//leading instructions without reaching an event. None of the leading instructions write,
+//so none can raise an interrupt line either.
+struct Fusion {
+    const char *name;
+    std::array<uint8_t, 3> opcodes;
+    uint8_t length;
+    //Cycles of the instructions before the last one
+    uint8_t lead_cycles;
+    //Runs the instruction it's given and the ones following it
+    Replay replay;
+    //Further conditions on the decoded instructions; null when the opcodes are enough
+    bool (*applies)(const Memory &memory, const DecodedInstruction *code);
+};
+
+//Entry 0 stands for no fusion
+constexpr size_t FUSION_COUNT = 8;
+
+extern const std::array<Fusion, FUSION_COUNT> fusions;
+
+//The fusion starting at code[0], 0 for none
+uint8_t match_fusion(const Memory &memory, std::span<const DecodedInstruction> code);
+
+#endif //NESEMULATOR_FUSION_H
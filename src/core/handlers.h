@@ -0,0 +1,637 @@
+#ifndef NESEMULATOR_HANDLERS_H
+#define NESEMULATOR_HANDLERS_H
+
+#include <array>
+#include <type_traits>
+#include "state.h"
+#include "basics.h"
+#include "instructions.h"
+#include "operations.h"
+
+//The opcode handlers behind the tables in instructions.cpp. They live in a header so code
+//compiled ahead of time (see tools/recompiler.cpp) can call them directly and have them
+//inlined.
+
+//Opcodes the table doesn't implement behave like a 2 cycle NOP
+inline int instr_unimplemented(Cpu6502_State &cs) {
+    return 2;
+}
+
+inline Addr get_2b_addr(Cpu6502_State &cs) {
+    Val low = cs.get_instr_byte();
+    Val high = cs.get_instr_byte();
+    return Addr((static_cast<uint16_t>(high.val) << 8) | static_cast<uint16_t>(low.val));
+}
+
+inline Addr indirect_addr(Cpu6502_State &cs, ZeroPageAddr addr_addr) {
+    ZeroPageAddr addr_addr_2 = addr_addr + ZeroPageAddr(Val(1));
+    Val lower = cs.get_byte(addr_addr);
+    Val higher = cs.get_byte(addr_addr_2);
+    Addr addr = Addr(lower.val) | (Addr(higher.val) << 8);
+    return addr;
+}
+
+//ONLY FOR JUMPS
+inline Addr indirect_addr_jump(Cpu6502_State &cs, Addr addr_addr) {
+    Addr addr_addr_2 = addr_addr + Addr(1);
+    //hardware issue on the mos 6502
+    addr_addr_2 = Addr((addr_addr_2.addr & 0xFF) | (addr_addr.addr & 0xFF00));
+    Val lower = cs.get_byte(addr_addr);
+    Val higher = cs.get_byte(addr_addr_2);
+    Addr addr = Addr(lower.val) | (Addr(higher.val) << 8);
+    return addr;
+}
+
+//Effective address of an operand, and whether indexing crossed a page
+struct Operand {
+    Addr addr;
+    bool page_crossed;
+};
+
+inline Operand indexed(Addr base_addr, Val index) {
+    Addr addr = base_addr + Addr(index.val);
+    bool p = (base_addr.addr & 0xFF00) != (addr.addr & 0xFF00);
+    return {addr, p};
+}
+
+inline Operand indexed_zero_page(ZeroPageAddr base_addr, Val index) {
+    ZeroPageAddr addr = base_addr + ZeroPageAddr(index);
+    return {Addr(addr.addr), false};
+}
+
+//Addressing modes. resolve() consumes the operand bytes and returns the effective address
+//without touching it; the *_cycles constants are the totals for each kind of operation.
+//Read operations take one extra cycle when resolve() reports a page crossing.
+//resolve(cs, operand) does the same with operand bytes fetched earlier (predecoded code).
+
+//#imm: the operand byte itself is the value
+struct Imm {
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 2;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        Addr addr = cs.reg().getPC();
+        cs.reg().incrPC();
+        return {addr, false};
+    }
+};
+
+//zp
+struct Zp {
+    static constexpr WriteTarget target = WriteTarget::OPERAND;
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 3;
+    static constexpr int write_cycles = 3;
+    static constexpr int rmw_cycles = 5;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, cs.get_instr_byte().val);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return {Addr(operand & 0xFF), false};
+    }
+};
+
+//zp,X
+struct ZpX {
+    static constexpr WriteTarget target = WriteTarget::ZERO_PAGE;
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 4;
+    static constexpr int write_cycles = 4;
+    static constexpr int rmw_cycles = 6;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, cs.get_instr_byte().val);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return indexed_zero_page(ZeroPageAddr(Val(operand)), cs.reg().getX());
+    }
+};
+
+//zp,Y
+struct ZpY {
+    static constexpr WriteTarget target = WriteTarget::ZERO_PAGE;
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 4;
+    static constexpr int write_cycles = 4;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, cs.get_instr_byte().val);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return indexed_zero_page(ZeroPageAddr(Val(operand)), cs.reg().getY());
+    }
+};
+
+//abs
+struct Abs {
+    static constexpr WriteTarget target = WriteTarget::OPERAND;
+    static constexpr int length = 3;
+    static constexpr int read_cycles = 4;
+    static constexpr int write_cycles = 4;
+    static constexpr int rmw_cycles = 6;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, get_2b_addr(cs).addr);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return {Addr(operand), false};
+    }
+};
+
+//abs,X
+struct AbsX {
+    static constexpr WriteTarget target = WriteTarget::ANYWHERE;
+    static constexpr int length = 3;
+    static constexpr int read_cycles = 4;
+    static constexpr int write_cycles = 5;
+    static constexpr int rmw_cycles = 7;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, get_2b_addr(cs).addr);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return indexed(Addr(operand), cs.reg().getX());
+    }
+};
+
+//abs,Y
+struct AbsY {
+    static constexpr WriteTarget target = WriteTarget::ANYWHERE;
+    static constexpr int length = 3;
+    static constexpr int read_cycles = 4;
+    static constexpr int write_cycles = 5;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, get_2b_addr(cs).addr);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        return indexed(Addr(operand), cs.reg().getY());
+    }
+};
+
+//(zp,X)
+struct IndX {
+    static constexpr WriteTarget target = WriteTarget::ANYWHERE;
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 6;
+    static constexpr int write_cycles = 6;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, cs.get_instr_byte().val);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        ZeroPageAddr addr_addr = ZeroPageAddr(Val(operand) + cs.reg().getX());
+        return {indirect_addr(cs, addr_addr), false};
+    }
+};
+
+//(zp),Y
+struct IndY {
+    static constexpr WriteTarget target = WriteTarget::ANYWHERE;
+    static constexpr int length = 2;
+    static constexpr int read_cycles = 5;
+    static constexpr int write_cycles = 6;
+
+    static Operand resolve(Cpu6502_State &cs) {
+        return resolve(cs, cs.get_instr_byte().val);
+    }
+
+    static Operand resolve(Cpu6502_State &cs, uint16_t operand) {
+        auto addr_addr = ZeroPageAddr(Val(operand));
+        return indexed(indirect_addr(cs, addr_addr), cs.reg().getY());
+    }
+};
+
+//A: only used by the shift/rotate family, handled directly by Op
+struct Acc {
+    static constexpr int length = 1;
+    static constexpr int rmw_cycles = 2;
+};
+
+//An opcode: one operation combined with one addressing mode
+template<class Operation, class Mode>
+struct Op {
+    static constexpr int length = Mode::length;
+    static constexpr WriteTarget writes = [] {
+        if constexpr (Operation::kind == OpKind::READ || std::is_same_v<Mode, Acc>)
+            return WriteTarget::NONE;
+        else
+            return Mode::target;
+    }();
+    static constexpr bool ends_block = false;
+
+    static int act(Cpu6502_State &cs) {
+        if constexpr (std::is_same_v<Mode, Acc>)
+            return execute(cs, {});
+        else
+            return execute(cs, Mode::resolve(cs));
+    }
+
+    static int replay(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        cs.reg().setPC(Addr(instr.next_pc));
+        if constexpr (std::is_same_v<Mode, Acc>) {
+            return execute(cs, {});
+        } else if constexpr (std::is_same_v<Mode, Imm>) {
+            Operation::exec(cs, Val(static_cast<uint8_t>(instr.operand)));
+            return Mode::read_cycles;
+        } else {
+            return execute(cs, Mode::resolve(cs, instr.operand));
+        }
+    }
+
+private:
+    static int execute(Cpu6502_State &cs, Operand op) {
+        if constexpr (Operation::kind == OpKind::READ) {
+            Operation::exec(cs, cs.get_byte(op.addr));
+            return Mode::read_cycles + op.page_crossed;
+        } else if constexpr (Operation::kind == OpKind::WRITE) {
+            cs.set_byte(op.addr, Operation::value(cs));
+            return Mode::write_cycles;
+        } else if constexpr (std::is_same_v<Mode, Acc>) {
+            cs.reg().setA(Operation::exec(cs, cs.reg().getA()));
+            return Mode::rmw_cycles;
+        } else {
+            Val current = cs.get_byte(op.addr);
+            //The unmodified value is written back while the ALU works, as MMC1 sees
+            cs.set_byte(op.addr, current);
+            cs.set_byte(op.addr, Operation::exec(cs, current));
+            return Mode::rmw_cycles;
+        }
+    }
+};
+
+template<FlagPositions flag, bool value>
+struct Branch {
+    static constexpr int length = 2;
+    static constexpr WriteTarget writes = WriteTarget::NONE;
+    static constexpr bool ends_block = true;
+
+    static int act(Cpu6502_State &cs) {
+        return take(cs, static_cast<int8_t>(cs.get_instr_byte().val));
+    }
+
+    static int replay(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        cs.reg().setPC(Addr(instr.next_pc));
+        return take(cs, static_cast<int8_t>(instr.operand));
+    }
+
+private:
+    static int take(Cpu6502_State &cs, int8_t offset) {
+        if (cs.reg().get_flag(flag) == value) {
+            uint16_t new_pc_addr = static_cast<uint16_t>(cs.reg().getPC().addr + offset);
+            bool page_crossed = (cs.reg().getPC().addr & 0xFF00) != (new_pc_addr & 0xFF00);
+            cs.reg().setPC(Addr(new_pc_addr));
+            return 3 + (page_crossed ? 1 : 0);
+        }
+        return 2;
+    }
+};
+
+//The table entry for a handler struct (Op, Branch, the jumps below)
+template<class Handler>
+constexpr OpcodeInfo opcode() {
+    return {Handler::act, Handler::replay, Handler::length, Handler::writes, Handler::ends_block};
+}
+
+//Single byte opcodes have nothing to predecode, so replaying one is just running it
+template<Instruction handler>
+int replay_implied(Cpu6502_State &cs, const DecodedInstruction &instr) {
+    cs.reg().setPC(Addr(instr.next_pc));
+    return handler(cs);
+}
+
+template<Instruction handler, WriteTarget writes = WriteTarget::NONE, bool ends_block = false>
+constexpr OpcodeInfo implied() {
+    return {handler, replay_implied<handler>, 1, writes, ends_block};
+}
+
+template<int base_addr, class Operation>
+constexpr void create_acc_suite(std::array<OpcodeInfo, 256> &res) {
+    if constexpr (Operation::kind != OpKind::WRITE)
+        res[base_addr + 0x09] = opcode<Op<Operation, Imm>>();
+    res[base_addr + 0x0D] = opcode<Op<Operation, Abs>>();
+    res[base_addr + 0x1D] = opcode<Op<Operation, AbsX>>();
+    res[base_addr + 0x19] = opcode<Op<Operation, AbsY>>();
+    res[base_addr + 0x05] = opcode<Op<Operation, Zp>>();
+    res[base_addr + 0x15] = opcode<Op<Operation, ZpX>>();
+    res[base_addr + 0x01] = opcode<Op<Operation, IndX>>();
+    res[base_addr + 0x11] = opcode<Op<Operation, IndY>>();
+}
+
+template<int base_addr, class Operation, bool include_acc>
+constexpr void create_shift_suite(std::array<OpcodeInfo, 256> &res) {
+    if constexpr (include_acc)
+        res[base_addr + 0x0A] = opcode<Op<Operation, Acc>>();
+    res[base_addr + 0x0E] = opcode<Op<Operation, Abs>>();
+    res[base_addr + 0x1E] = opcode<Op<Operation, AbsX>>();
+    res[base_addr + 0x06] = opcode<Op<Operation, Zp>>();
+    res[base_addr + 0x16] = opcode<Op<Operation, ZpX>>();
+}
+
+inline int op_tax(Cpu6502_State &cs) {
+    cs.reg().setX(cs.reg().getA());
+    cs.reg().set_nz(cs.reg().getA());
+    return 2;
+}
+
+inline int op_tay(Cpu6502_State &cs) {
+    cs.reg().setY(cs.reg().getA());
+    cs.reg().set_nz(cs.reg().getA());
+    return 2;
+}
+
+inline int op_tsx(Cpu6502_State &cs) {
+    cs.reg().setX(cs.reg().getS());
+    cs.reg().set_nz(cs.reg().getS());
+    return 2;
+}
+
+inline int op_txa(Cpu6502_State &cs) {
+    cs.reg().setA(cs.reg().getX());
+    cs.reg().set_nz(cs.reg().getX());
+    return 2;
+}
+
+inline int op_txs(Cpu6502_State &cs) {
+    cs.reg().setS(cs.reg().getX());
+    return 2;
+}
+
+inline int op_tya(Cpu6502_State &cs) {
+    cs.reg().setA(cs.reg().getY());
+    cs.reg().set_nz(cs.reg().getY());
+    return 2;
+}
+
+inline int op_pha(Cpu6502_State &cs) {
+    cs.push_stack(cs.reg().getA());
+    return 3;
+}
+
+inline int op_php(Cpu6502_State &cs) {
+    cs.push_stack(Val(cs.reg().getP().val | 0x30));
+    return 3;
+}
+
+inline int op_pla(Cpu6502_State &cs) {
+    cs.reg().setA(cs.pull_stack());
+    cs.reg().set_nz(cs.reg().getA());
+    return 4;
+}
+
+inline int op_plp(Cpu6502_State &cs) {
+    cs.reg().setP(cs.pull_stack());
+    cs.reg().set_flag(FlagPositions::UNUSED, true);
+    cs.reg().set_flag(FlagPositions::B, false);
+    return 4;
+}
+
+inline int op_dex(Cpu6502_State &cs) {
+    cs.reg().setX(cs.reg().getX() - Val(1));
+    cs.reg().set_nz(cs.reg().getX());
+    return 2;
+}
+
+inline int op_dey(Cpu6502_State &cs) {
+    cs.reg().setY(cs.reg().getY() - Val(1));
+    cs.reg().set_nz(cs.reg().getY());
+    return 2;
+}
+
+inline int op_inx(Cpu6502_State &cs) {
+    cs.reg().setX(cs.reg().getX() + Val(1));
+    cs.reg().set_nz(cs.reg().getX());
+    return 2;
+}
+
+inline int op_iny(Cpu6502_State &cs) {
+    cs.reg().setY(cs.reg().getY() + Val(1));
+    cs.reg().set_nz(cs.reg().getY());
+    return 2;
+}
+
+struct JmpAbsolute {
+    static constexpr int length = 3;
+    static constexpr WriteTarget writes = WriteTarget::NONE;
+    static constexpr bool ends_block = true;
+
+    static int act(Cpu6502_State &cs) {
+        cs.reg().setPC(get_2b_addr(cs));
+        return 3;
+    }
+
+    static int replay(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        cs.reg().setPC(Addr(instr.operand));
+        return 3;
+    }
+};
+
+struct JmpIndirect {
+    static constexpr int length = 3;
+    static constexpr WriteTarget writes = WriteTarget::NONE;
+    static constexpr bool ends_block = true;
+
+    static int act(Cpu6502_State &cs) {
+        cs.reg().setPC(indirect_addr_jump(cs, get_2b_addr(cs)));
+        return 5;
+    }
+
+    static int replay(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        cs.reg().setPC(indirect_addr_jump(cs, Addr(instr.operand)));
+        return 5;
+    }
+};
+
+struct Jsr {
+    static constexpr int length = 3;
+    static constexpr WriteTarget writes = WriteTarget::STACK;
+    static constexpr bool ends_block = true;
+
+    static int act(Cpu6502_State &cs) {
+        return call(cs, get_2b_addr(cs));
+    }
+
+    static int replay(Cpu6502_State &cs, const DecodedInstruction &instr) {
+        cs.reg().setPC(Addr(instr.next_pc));
+        return call(cs, Addr(instr.operand));
+    }
+
+private:
+    static int call(Cpu6502_State &cs, Addr new_pc) {
+        auto ret_addr = cs.reg().getPC().addr - 1;
+        cs.push_stack(Val(static_cast<uint8_t>(ret_addr >> 8)));
+        cs.push_stack(Val(static_cast<uint8_t>(ret_addr & 0xFF)));
+        cs.reg().setPC(new_pc);
+        return 6;
+    }
+};
+
+inline int op_rts(Cpu6502_State &cs) {
+    Val low = cs.pull_stack();
+    Val high = cs.pull_stack();
+    Addr PC = Addr((static_cast<uint16_t>(high.val) << 8) | static_cast<uint16_t>(low.val));
+    cs.reg().setPC(PC);
+    cs.reg().incrPC();
+    return 6;
+}
+
+template<FlagPositions flag, bool value>
+int op_set_flag(Cpu6502_State &cs) {
+    cs.reg().set_flag(flag, value);
+    return 2;
+}
+
+inline int op_nop(Cpu6502_State &cs) {
+    //Fabled NOP
+    return 2;
+}
+
+//Interrupts: Last but not least
+//Pushes the return address and P, then jumps through vector. B is only set in the pushed copy.
+inline void enter_interrupt(Cpu6502_State &cs, Addr return_addr, bool brk, Addr vector) {
+    cs.push_stack(Val(static_cast<uint8_t>(return_addr.addr >> 8)));
+    cs.push_stack(Val(static_cast<uint8_t>(return_addr.addr & 0xFF)));
+
+    cs.reg().set_flag(FlagPositions::B, brk);
+    cs.push_stack(Val(cs.reg().getP()));
+    cs.reg().set_flag(FlagPositions::B, false);
+
+    cs.reg().set_flag(FlagPositions::INTERRUPT_DISABLE, true);
+
+    uint8_t low = cs.get_byte(vector).val;
+    uint8_t high = cs.get_byte(Addr(vector.addr + 1)).val;
+    Addr new_pc = Addr((static_cast<uint16_t>(high) << 8) | low);
+    cs.reg().setPC(new_pc);
+}
+
+inline int op_brk(Cpu6502_State &cs) {
+    enter_interrupt(cs, Addr(cs.reg().getPC().addr + 1), true, Addr(IRQ_VECTOR));
+    return 7;
+}
+
+inline int op_rti(Cpu6502_State &cs) {
+    cs.reg().setP(cs.pull_stack());
+    cs.reg().set_flag(FlagPositions::UNUSED, true);
+    cs.reg().set_flag(FlagPositions::B, false);
+    uint8_t low = cs.pull_stack().val;
+    uint8_t high = cs.pull_stack().val;
+    Addr new_pc = Addr((static_cast<uint16_t>(high) << 8) | low);
+
+    // Set the Program Counter to the new address
+    cs.reg().setPC(new_pc);
+    return 6;
+}
+
+//Fetch is assumed to run before this happens automatically
+constexpr std::array<OpcodeInfo, 256> opcode_ref() {
+    std::array<OpcodeInfo, 256> res{};
+    for (auto &instr: res)
+        instr = implied<instr_unimplemented>();
+
+    create_acc_suite<0x00, ORA>(res);
+    create_acc_suite<0x20, AND>(res);
+    create_acc_suite<0x40, EOR>(res);
+    create_acc_suite<0x60, ADC>(res);
+    create_acc_suite<0x80, STA>(res);
+    create_acc_suite<0xA0, LDA>(res);
+    create_acc_suite<0xC0, CMP>(res);
+    create_acc_suite<0xE0, SBC>(res);
+
+    create_shift_suite<0x00, ASL, true>(res);
+    create_shift_suite<0x40, LSR, true>(res);
+    create_shift_suite<0x20, ROL, true>(res);
+    create_shift_suite<0x60, ROR, true>(res);
+    create_shift_suite<0xC0, DEC, false>(res);
+    create_shift_suite<0xE0, INC, false>(res);
+
+    res[0xA2] = opcode<Op<LDX, Imm>>();
+    res[0xAE] = opcode<Op<LDX, Abs>>();
+    res[0xBE] = opcode<Op<LDX, AbsY>>();
+    res[0xA6] = opcode<Op<LDX, Zp>>();
+    res[0xB6] = opcode<Op<LDX, ZpY>>();
+
+    res[0xA0] = opcode<Op<LDY, Imm>>();
+    res[0xAC] = opcode<Op<LDY, Abs>>();
+    res[0xBC] = opcode<Op<LDY, AbsX>>();
+    res[0xA4] = opcode<Op<LDY, Zp>>();
+    res[0xB4] = opcode<Op<LDY, ZpX>>();
+
+    res[0x8E] = opcode<Op<STX, Abs>>();
+    res[0x86] = opcode<Op<STX, Zp>>();
+    res[0x96] = opcode<Op<STX, ZpY>>();
+
+    res[0x8C] = opcode<Op<STY, Abs>>();
+    res[0x84] = opcode<Op<STY, Zp>>();
+    res[0x94] = opcode<Op<STY, ZpX>>();
+
+    res[0xAA] = implied<op_tax>();
+    res[0xA8] = implied<op_tay>();
+    res[0xBA] = implied<op_tsx>();
+    res[0x8A] = implied<op_txa>();
+    res[0x9A] = implied<op_txs>();
+    res[0x98] = implied<op_tya>();
+
+    res[0x48] = implied<op_pha, WriteTarget::STACK>();
+    res[0x08] = implied<op_php, WriteTarget::STACK>();
+    res[0x68] = implied<op_pla>();
+    res[0x28] = implied<op_plp, WriteTarget::NONE, true>();
+
+    res[0x2C] = opcode<Op<BIT, Abs>>();
+    res[0x24] = opcode<Op<BIT, Zp>>();
+
+    res[0xE0] = opcode<Op<CPX, Imm>>();
+    res[0xEC] = opcode<Op<CPX, Abs>>();
+    res[0xE4] = opcode<Op<CPX, Zp>>();
+
+    res[0xC0] = opcode<Op<CPY, Imm>>();
+    res[0xCC] = opcode<Op<CPY, Abs>>();
+    res[0xC4] = opcode<Op<CPY, Zp>>();
+
+    res[0xCA] = implied<op_dex>();
+    res[0x88] = implied<op_dey>();
+    res[0xE8] = implied<op_inx>();
+    res[0xC8] = implied<op_iny>();
+
+    res[0x4C] = opcode<JmpAbsolute>();
+    res[0x6C] = opcode<JmpIndirect>();
+    res[0x20] = opcode<Jsr>();
+    res[0x60] = implied<op_rts, WriteTarget::NONE, true>();
+
+    res[0x90] = opcode<Branch<FlagPositions::CARRY, false>>();
+    res[0xB0] = opcode<Branch<FlagPositions::CARRY, true>>();
+    res[0xF0] = opcode<Branch<FlagPositions::ZERO, true>>();
+    res[0x30] = opcode<Branch<FlagPositions::NEG, true>>();
+    res[0xD0] = opcode<Branch<FlagPositions::ZERO, false>>();
+    res[0x10] = opcode<Branch<FlagPositions::NEG, false>>();
+    res[0x50] = opcode<Branch<FlagPositions::OVF, false>>();
+    res[0x70] = opcode<Branch<FlagPositions::OVF, true>>();
+
+    res[0x18] = implied<op_set_flag<FlagPositions::CARRY, false>>();
+    res[0xD8] = implied<op_set_flag<FlagPositions::DECIMAL, false>>();
+    res[0x58] = implied<op_set_flag<FlagPositions::INTERRUPT_DISABLE, false>, WriteTarget::NONE, true>();
+    res[0xB8] = implied<op_set_flag<FlagPositions::OVF, false>>();
+    res[0x38] = implied<op_set_flag<FlagPositions::CARRY, true>>();
+    res[0xF8] = implied<op_set_flag<FlagPositions::DECIMAL, true>>();
+    res[0x78] = implied<op_set_flag<FlagPositions::INTERRUPT_DISABLE, true>>();
+    res[0xEA] = implied<op_nop>();
+
+    res[0x00] = implied<op_brk, WriteTarget::STACK, true>();
+    res[0x40] = implied<op_rti, WriteTarget::NONE, true>();
+    return res;
+}
+//The replay handler of one opcode, called directly rather than through the table
+template<uint8_t opcode>
+int replay_opcode(Cpu6502_State &cs, const DecodedInstruction &instr) {
+    constexpr Replay replay = opcode_ref()[opcode].replay;
+    return replay(cs, instr);
+}
+
+#endif //NESEMULATOR_HANDLERS_H
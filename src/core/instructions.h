@@ -2,18 +2,64 @@
 #define NESEMULATOR_INSTRUCTIONS_H
 
 #include <stdlib.h>
-#include <memory>
+#include <array>
 #include "state.h"
 
-class Instruction { ;
-public:
-    //return # of cycles
-    virtual int act(Cpu6502_State &cpu_state);
+//Executes one opcode (already fetched) and returns # of cycles
+using Instruction = int (*)(Cpu6502_State &cpu_state);
+
+
+extern const std::array<Instruction, 256> instructions;
+
+struct DecodedInstruction;
+
+//Executes one predecoded opcode (see block_cache.h), moving PC past it as a fetch would
+//have, and returns # of cycles. The operand bytes are in instr.
+using Replay = int (*)(Cpu6502_State &cpu_state, const DecodedInstruction &instr);
+
+//An opcode as fetched once and kept: what to run, and what it was fetched with
+struct DecodedInstruction {
+    Replay replay;
+    //The operand bytes as a little-endian word; 0 for one byte instructions
+    uint16_t operand;
+    uint16_t next_pc;
+    uint8_t opcode;
+    //The idiom starting here, as an index into fusions (fusion.h); 0 for none
+    uint8_t fusion;
+};
+
+//Where an opcode writes, as far as decoding can tell
+enum class WriteTarget : uint8_t {
+    NONE,
+    //The operand is the address (zp, abs)
+    OPERAND,
+    //Somewhere in page 0 (zp,X and zp,Y)
+    ZERO_PAGE,
+    //Page 1 (pushes)
+    STACK,
+    //Depends on registers or memory (indexed abs, indirect)
+    ANYWHERE
+};
+
+//What decoding needs to know about an opcode
+struct OpcodeInfo {
+    Instruction run;
+    Replay replay;
+    //Including the opcode itself
+    uint8_t length;
+    WriteTarget writes;
+    //Jumps, branches, calls and returns, where PC doesn't just fall through, and CLI and PLP,
+    //after which a pending IRQ may be taken
+    bool ends_block;
 };
 
-using InstructionPtr = std::shared_ptr<Instruction>;
+extern const std::array<OpcodeInfo, 256> opcodes;
 
+constexpr uint16_t NMI_VECTOR = 0xFFFA;
+constexpr uint16_t IRQ_VECTOR = 0xFFFE;
 
-extern const std::array<InstructionPtr, 256> instructions;
+//Takes a pending NMI, or an IRQ when I is clear. Call between instructions; returns the
+//cycles spent (7), or 0 when nothing was taken.
+int service_interrupt(Cpu6502_State &cpu_state);
 
 #endif //NESEMULATOR_INSTRUCTIONS_H
@@ -0,0 +1,945 @@
+#include "jit.h"
+#include <array>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+#include "handlers.h"
+
+#ifdef NESEMULATOR_HAS_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#endif
+
+using namespace std;
+
+#ifdef NESEMULATOR_HAS_JIT
+namespace {
+    //Registers in compiled blocks. The long-lived ones are callee-saved, so calls out leave
+    //them alone: rbx the frame, rbp the 6502 registers (Reg), r12 the CPU state, r13 the
+    //budget, r14 the budget at or below which the block leaves, r15 Memory's read page table.
+    //rax, rcx, rdx and rsi are scratch: an instruction's value, its address and temporaries.
+    enum Register : uint8_t {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    //Stack slots below the pushes: the address and value across a call out, a pointer's low
+    //byte (or a read-modify-write's unmodified value, as those are never indirect), and
+    //Memory's write page table
+    constexpr int32_t SAVED_ADDRESS = 0;
+    constexpr int32_t SAVED_VALUE = 4;
+    constexpr int32_t POINTER_LOW = 8;
+    constexpr int32_t UNMODIFIED = POINTER_LOW;
+    constexpr int32_t WRITE_PAGES = 16;
+    constexpr uint8_t FRAME_SIZE = 24;
+
+    constexpr uint8_t JLE = 0x8E;
+    constexpr uint8_t JNE = 0x85;
+    constexpr uint8_t JE = 0x84;
+
+    static_assert(sizeof(JitFrame) < 0x80, "frame fields are addressed with 8-bit displacements");
+    static_assert(sizeof(InterruptLines) == 2 && offsetof(InterruptLines, nmi) == 1,
+                  "both interrupt lines are compared as one 16-bit word");
+
+    //Where Reg keeps each register, filled in by Jit (a friend of Reg)
+    struct RegLayout {
+        int32_t a, x, y, pc, s, p, n, z, c, v;
+    };
+
+    //For the bus accesses that don't go to a plain page, so reach an MMIO handler
+    uint8_t read_slow(Cpu6502_State *cs, uint32_t address) {
+        return cs->mem().read_byte(static_cast<uint16_t>(address));
+    }
+
+    void write_slow(Cpu6502_State *cs, uint32_t address, uint32_t value) {
+        cs->mem().write_byte(static_cast<uint16_t>(address), static_cast<uint8_t>(value));
+    }
+
+    //How an opcode is compiled: inline, from an operation and an addressing mode, or as a
+    //call to its replay handler (CALL)
+    enum class Kind : uint8_t {
+        CALL,
+        LDA, LDX, LDY, STA, STX, STY,
+        ORA, AND, EOR, ADC, SBC, CMP, CPX, CPY, BIT,
+        ASL, LSR, ROL, ROR, INC, DEC,
+        INX, INY, DEX, DEY, TAX, TAY, TXA, TYA, TSX, TXS,
+        CLC, SEC, CLV, CLD, SED, CLI, SEI, NOP,
+        BPL, BMI, BVC, BVS, BCC, BCS, BNE, BEQ, JMP
+    };
+
+    enum class Mode : uint8_t {
+        IMPLIED, ACC, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY, INDX, INDY
+    };
+
+    struct Compiled {
+        Kind kind;
+        Mode mode;
+        //As the handler would return, page crossings apart
+        uint8_t cycles;
+    };
+
+    enum class Access : uint8_t {
+        READ, WRITE, MODIFY
+    };
+
+    //The cycles of each mode, from the handlers' own addressing modes
+    constexpr uint8_t mode_cycles(Mode mode, Access access) {
+        auto pick = [access](int read, int write, int modify) {
+            return static_cast<uint8_t>(access == Access::READ ? read : access == Access::WRITE ? write : modify);
+        };
+        switch (mode) {
+            case Mode::IMM:
+                return Imm::read_cycles;
+            case Mode::ZP:
+                return pick(Zp::read_cycles, Zp::write_cycles, Zp::rmw_cycles);
+            case Mode::ZPX:
+                return pick(ZpX::read_cycles, ZpX::write_cycles, ZpX::rmw_cycles);
+            case Mode::ZPY:
+                return pick(ZpY::read_cycles, ZpY::write_cycles, 0);
+            case Mode::ABS:
+                return pick(Abs::read_cycles, Abs::write_cycles, Abs::rmw_cycles);
+            case Mode::ABSX:
+                return pick(AbsX::read_cycles, AbsX::write_cycles, AbsX::rmw_cycles);
+            case Mode::ABSY:
+                return pick(AbsY::read_cycles, AbsY::write_cycles, 0);
+            case Mode::INDX:
+                return pick(IndX::read_cycles, IndX::write_cycles, 0);
+            case Mode::INDY:
+                return pick(IndY::read_cycles, IndY::write_cycles, 0);
+            case Mode::ACC:
+                return Acc::rmw_cycles;
+            default:
+                return 2;
+        }
+    }
+
+    constexpr Access access_of(Kind kind) {
+        if (kind == Kind::STA || kind == Kind::STX || kind == Kind::STY)
+            return Access::WRITE;
+        if (kind >= Kind::ASL && kind <= Kind::DEC)
+            return Access::MODIFY;
+        return Access::READ;
+    }
+
+    //Mirrors the opcode table in handlers.h for everything that's compiled inline
+    constexpr array<Compiled, 256> compiled_ref() {
+        array<Compiled, 256> res{};
+        auto set = [&res](uint8_t opcode, Kind kind, Mode mode) {
+            res[opcode] = {kind, mode, mode_cycles(mode, access_of(kind))};
+        };
+        constexpr pair<uint8_t, Mode> acc_suite[] = {
+                {0x09, Mode::IMM}, {0x0D, Mode::ABS}, {0x1D, Mode::ABSX}, {0x19, Mode::ABSY},
+                {0x05, Mode::ZP}, {0x15, Mode::ZPX}, {0x01, Mode::INDX}, {0x11, Mode::INDY}};
+        constexpr pair<uint8_t, Kind> acc_ops[] = {
+                {0x00, Kind::ORA}, {0x20, Kind::AND}, {0x40, Kind::EOR}, {0x60, Kind::ADC},
+                {0x80, Kind::STA}, {0xA0, Kind::LDA}, {0xC0, Kind::CMP}, {0xE0, Kind::SBC}};
+        for (auto [base, kind] : acc_ops)
+            for (auto [offset, mode] : acc_suite)
+                if (kind != Kind::STA || mode != Mode::IMM)
+                    set(base + offset, kind, mode);
+        constexpr pair<uint8_t, Mode> shift_suite[] = {
+                {0x0E, Mode::ABS}, {0x1E, Mode::ABSX}, {0x06, Mode::ZP}, {0x16, Mode::ZPX}};
+        constexpr pair<uint8_t, Kind> shift_ops[] = {
+                {0x00, Kind::ASL}, {0x40, Kind::LSR}, {0x20, Kind::ROL}, {0x60, Kind::ROR},
+                {0xC0, Kind::DEC}, {0xE0, Kind::INC}};
+        for (auto [base, kind] : shift_ops) {
+            for (auto [offset, mode] : shift_suite)
+                set(base + offset, kind, mode);
+            if (kind != Kind::DEC && kind != Kind::INC)
+                set(base + 0x0A, kind, Mode::ACC);
+        }
+
+        set(0xA2, Kind::LDX, Mode::IMM);
+        set(0xAE, Kind::LDX, Mode::ABS);
+        set(0xBE, Kind::LDX, Mode::ABSY);
+        set(0xA6, Kind::LDX, Mode::ZP);
+        set(0xB6, Kind::LDX, Mode::ZPY);
+        set(0xA0, Kind::LDY, Mode::IMM);
+        set(0xAC, Kind::LDY, Mode::ABS);
+        set(0xBC, Kind::LDY, Mode::ABSX);
+        set(0xA4, Kind::LDY, Mode::ZP);
+        set(0xB4, Kind::LDY, Mode::ZPX);
+        set(0x8E, Kind::STX, Mode::ABS);
+        set(0x86, Kind::STX, Mode::ZP);
+        set(0x96, Kind::STX, Mode::ZPY);
+        set(0x8C, Kind::STY, Mode::ABS);
+        set(0x84, Kind::STY, Mode::ZP);
+        set(0x94, Kind::STY, Mode::ZPX);
+        set(0x2C, Kind::BIT, Mode::ABS);
+        set(0x24, Kind::BIT, Mode::ZP);
+        set(0xE0, Kind::CPX, Mode::IMM);
+        set(0xEC, Kind::CPX, Mode::ABS);
+        set(0xE4, Kind::CPX, Mode::ZP);
+        set(0xC0, Kind::CPY, Mode::IMM);
+        set(0xCC, Kind::CPY, Mode::ABS);
+        set(0xC4, Kind::CPY, Mode::ZP);
+
+        constexpr pair<uint8_t, Kind> implied[] = {
+                {0xE8, Kind::INX}, {0xC8, Kind::INY}, {0xCA, Kind::DEX}, {0x88, Kind::DEY},
+                {0xAA, Kind::TAX}, {0xA8, Kind::TAY}, {0x8A, Kind::TXA}, {0x98, Kind::TYA},
+                {0xBA, Kind::TSX}, {0x9A, Kind::TXS}, {0x18, Kind::CLC}, {0x38, Kind::SEC},
+                {0xB8, Kind::CLV}, {0xD8, Kind::CLD}, {0xF8, Kind::SED}, {0x58, Kind::CLI},
+                {0x78, Kind::SEI}, {0xEA, Kind::NOP}, {0x10, Kind::BPL}, {0x30, Kind::BMI},
+                {0x50, Kind::BVC}, {0x70, Kind::BVS}, {0x90, Kind::BCC}, {0xB0, Kind::BCS},
+                {0xD0, Kind::BNE}, {0xF0, Kind::BEQ}};
+        for (auto [opcode, kind] : implied)
+            set(opcode, kind, Mode::IMPLIED);
+        res[0x4C] = {Kind::JMP, Mode::IMPLIED, 3};
+        return res;
+    }
+
+    constexpr array<Compiled, 256> compiled = compiled_ref();
+
+    //Just the x86-64 the compiler below needs
+    class Emitter {
+    public:
+        void bytes(initializer_list<uint8_t> list) {
+            code.insert(code.end(), list);
+        }
+
+        void imm8(uint8_t value) {
+            code.push_back(value);
+        }
+
+        void imm16(uint16_t value) {
+            imm8(static_cast<uint8_t>(value));
+            imm8(static_cast<uint8_t>(value >> 8));
+        }
+
+        void imm32(uint32_t value) {
+            for (int i = 0; i < 4; i++)
+                code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+
+        void imm64(uint64_t value) {
+            for (int i = 0; i < 8; i++)
+                code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+
+        //opcode with a ModRM operand [base + disp]; reg is a register or an opcode extension.
+        //Byte registers are only ever al, cl and dl, which need no REX.
+        void mem(initializer_list<uint8_t> opcode, int reg, int base, int32_t disp, bool wide = false) {
+            rex(wide, reg, 0, base);
+            bytes(opcode);
+            int mod = disp == 0 && (base & 7) != RBP ? 0 : disp >= -128 && disp < 128 ? 1 : 2;
+            imm8(mod << 6 | (reg & 7) << 3 | (base & 7));
+            if ((base & 7) == RSP)
+                imm8(0x24);
+            displacement(mod, disp);
+        }
+
+        //The same with [base + index * scale + disp]
+        void mem(initializer_list<uint8_t> opcode, int reg, int base, int index, int scale, int32_t disp,
+                 bool wide = false) {
+            rex(wide, reg, index, base);
+            bytes(opcode);
+            int mod = disp == 0 && (base & 7) != RBP ? 0 : disp >= -128 && disp < 128 ? 1 : 2;
+            imm8(mod << 6 | (reg & 7) << 3 | RSP);
+            imm8((scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0) << 6 | (index & 7) << 3 | (base & 7));
+            displacement(mod, disp);
+        }
+
+        //opcode with a register operand: reg, and rm in place of memory
+        void reg(initializer_list<uint8_t> opcode, int reg, int rm, bool wide = false) {
+            rex(wide, reg, 0, rm);
+            bytes(opcode);
+            imm8(0xC0 | (reg & 7) << 3 | (rm & 7));
+        }
+
+        //Conditional jump to a label that bind() places later
+        void jump(uint8_t condition, vector<size_t> &label) {
+            bytes({0x0F, condition});
+            label.push_back(code.size());
+            imm32(0);
+        }
+
+        void jump(vector<size_t> &label) {
+            imm8(0xE9);
+            label.push_back(code.size());
+            imm32(0);
+        }
+
+        //Unconditional jump back to where code was at
+        void jump_to(size_t at) {
+            imm8(0xE9);
+            imm32(static_cast<uint32_t>(at - (code.size() + 4)));
+        }
+
+        void bind(const vector<size_t> &label) {
+            for (size_t at : label) {
+                uint32_t rel = static_cast<uint32_t>(code.size() - (at + 4));
+                memcpy(code.data() + at, &rel, sizeof(rel));
+            }
+        }
+
+        vector<uint8_t> code;
+
+    private:
+        void rex(bool wide, int reg, int index, int base) {
+            uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | (base >> 3);
+            if (prefix != 0x40)
+                imm8(prefix);
+        }
+
+        void displacement(int mod, int32_t disp) {
+            if (mod == 1)
+                imm8(static_cast<uint8_t>(disp));
+            else if (mod == 2)
+                imm32(static_cast<uint32_t>(disp));
+        }
+    };
+
+    //Turns a block of decoded instructions into a function, see Jit::run
+    class Compiler {
+    public:
+        explicit Compiler(const RegLayout &reg) : reg(reg) {}
+
+        vector<uint8_t> compile(span<const DecodedInstruction> code) {
+            prologue();
+            for (size_t i = 0; i < code.size(); i++) {
+                //The interpreter loop's budget and event checks; the caller has made them for
+                //the first instruction. A change to the interrupt lines or a stall after a call
+                //out moves r14 so they fail too.
+                if (i > 0) {
+                    e.reg({0x39}, R14, R13, true);                           //cmp r13, r14
+                    e.jump(JLE, exit);
+                }
+                instruction(code[i]);
+                e.bytes({0xC6, 0x43, field(offsetof(JitFrame, opcode)), code[i].opcode}); //mov byte [rbx + opcode], imm8
+                check_stop();
+            }
+            epilogue();
+            for (auto &path : cold)
+                path();
+            return std::move(e.code);
+        }
+
+    private:
+        static constexpr uint8_t field(size_t offset) {
+            return static_cast<uint8_t>(offset);
+        }
+
+        void prologue() {
+            //Six pushes and the frame on top of the return address leave the stack aligned for calls
+            e.bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+            e.bytes({0x48, 0x83, 0xEC, FRAME_SIZE});                             //sub rsp, FRAME_SIZE
+            e.reg({0x89}, RDI, RBX, true);                                        //mov rbx, rdi
+            e.reg({0x89}, RSI, R15, true);                                        //mov r15, rsi
+            e.reg({0x89}, RDX, RBP, true);                                        //mov rbp, rdx
+            e.mem({0x89}, RCX, RSP, WRITE_PAGES, true);                          //mov [rsp + WRITE_PAGES], rcx
+            e.mem({0x8B}, R12, RBX, offsetof(JitFrame, state), true);            //mov r12, [rbx + state]
+            e.mem({0x8B}, R13, RBX, offsetof(JitFrame, budget), true);           //mov r13, [rbx + budget]
+            //r14 = max(event_budget, 0), so one compare covers both checks
+            e.mem({0x8B}, R14, RBX, offsetof(JitFrame, event_budget), true);     //mov r14, [rbx + event_budget]
+            e.reg({0x31}, RAX, RAX);                                              //xor eax, eax
+            e.reg({0x85}, R14, R14, true);                                        //test r14, r14
+            e.reg({0x0F, 0x4C}, R14, RAX, true);                                  //cmovl r14, rax
+        }
+
+        void epilogue() {
+            //Falling off the end of the block leaves through here too
+            e.bind(exit);
+            e.reg({0x31}, RAX, RAX);                                              //xor eax, eax
+            e.bytes({0xEB, 0x05});                                                //jmp past the mov
+            e.bind(stopped);
+            e.bytes({0xB8, 0x01, 0x00, 0x00, 0x00});                              //mov eax, 1
+            e.mem({0x89}, R13, RBX, offsetof(JitFrame, budget), true);           //mov [rbx + budget], r13
+            e.bytes({0x48, 0x83, 0xC4, FRAME_SIZE});                             //add rsp, FRAME_SIZE
+            e.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3}); //pop r15 ... rbx, ret
+        }
+
+        void check_stop() {
+            vector<size_t> no_stop;
+            e.mem({0x8B}, RAX, RBX, offsetof(JitFrame, stop), true);             //mov rax, [rbx + stop]
+            e.reg({0x85}, RAX, RAX, true);                                        //test rax, rax
+            e.jump(JE, no_stop);
+            e.mem({0x8B}, RDI, RBX, offsetof(JitFrame, stop_context), true);     //mov rdi, [rbx + stop_context]
+            e.reg({0x89}, R12, RSI, true);                                        //mov rsi, r12
+            e.bytes({0xFF, 0xD0});                                                //call rax
+            e.bytes({0x84, 0xC0});                                                //test al, al
+            e.jump(JNE, stopped);
+            e.bind(no_stop);
+        }
+
+        //Peripherals timestamp bus accesses with the CPU clock, so it's set before any call out
+        void store_clock() {
+            e.mem({0x8B}, RAX, RBX, offsetof(JitFrame, deadline), true);         //mov rax, [rbx + deadline]
+            e.reg({0x29}, R13, RAX, true);                                        //sub rax, r13
+            e.mem({0x8B}, RCX, RBX, offsetof(JitFrame, clock), true);            //mov rcx, [rbx + clock]
+            e.mem({0x89}, RAX, RCX, 0, true);                                     //mov [rcx], rax
+        }
+
+        //After a call out: when an interrupt line changed or DMA stalls the CPU, r14 is set so
+        //the next budget check leaves
+        void leave_on_interrupt_or_stall() {
+            vector<size_t> leave, stay;
+            e.mem({0x8B}, RCX, RBX, offsetof(JitFrame, lines), true);            //mov rcx, [rbx + lines]
+            e.mem({0x0F, 0xB7}, RCX, RCX, 0);                                     //movzx ecx, word [rcx]
+            e.bytes({0x66});
+            e.mem({0x3B}, RCX, RBX, offsetof(JitFrame, entry_lines));            //cmp cx, [rbx + entry_lines]
+            e.jump(JNE, leave);
+            e.mem({0x8B}, RCX, RBX, offsetof(JitFrame, stall), true);            //mov rcx, [rbx + stall]
+            e.mem({0x83}, 7, RCX, 0);                                             //cmp dword [rcx], 0
+            e.imm8(0);
+            e.jump(JE, stay);
+            e.bind(leave);
+            e.bytes({0x49, 0xBE});                                                //mov r14, INT64_MAX
+            e.imm64(INT64_MAX);
+            e.bind(stay);
+        }
+
+        void call(const void *function) {
+            e.bytes({0x48, 0xB8});                                                //mov rax, function
+            e.imm64(reinterpret_cast<uint64_t>(function));
+            e.bytes({0xFF, 0xD0});                                                //call rax
+        }
+
+        //Loads the byte at address (ecx, or constant when fixed) into eax, zero-extended.
+        //ecx is kept.
+        void read(bool fixed, uint16_t address) {
+            vector<size_t> slow;
+            if (fixed) {
+                e.mem({0x8B}, RDX, R15, (address >> 8) * 8, true);               //mov rdx, [r15 + page * 8]
+                e.reg({0x85}, RDX, RDX, true);                                    //test rdx, rdx
+                e.jump(JE, slow);
+                e.mem({0x0F, 0xB6}, RAX, RDX, address & 0xFF);                   //movzx eax, byte [rdx + low]
+            } else {
+                e.reg({0x89}, RCX, RDX);                                          //mov edx, ecx
+                e.bytes({0xC1, 0xEA, 0x08});                                      //shr edx, 8
+                e.mem({0x8B}, RDX, R15, RDX, 8, 0, true);                         //mov rdx, [r15 + rdx * 8]
+                e.reg({0x85}, RDX, RDX, true);                                    //test rdx, rdx
+                e.jump(JE, slow);
+                e.reg({0x0F, 0xB6}, RAX, RCX);                                    //movzx eax, cl
+                e.mem({0x0F, 0xB6}, RAX, RDX, RAX, 1, 0);                         //movzx eax, byte [rdx + rax]
+            }
+            size_t back = e.code.size();
+            cold.push_back([this, slow, back, fixed, address] {
+                e.bind(slow);
+                e.mem({0x89}, RCX, RSP, SAVED_ADDRESS);                           //mov [rsp + SAVED_ADDRESS], ecx
+                pass_address(fixed, address);
+                e.reg({0x89}, R12, RDI, true);                                    //mov rdi, r12
+                store_clock();
+                call(reinterpret_cast<const void *>(read_slow));
+                e.reg({0x0F, 0xB6}, RAX, RAX);                                    //movzx eax, al
+                leave_on_interrupt_or_stall();
+                e.mem({0x8B}, RCX, RSP, SAVED_ADDRESS);                           //mov ecx, [rsp + SAVED_ADDRESS]
+                e.jump_to(back);
+            });
+        }
+
+        //Stores al at address (ecx, or constant when fixed). A read-modify-write first writes
+        //back its unmodified value (UNMODIFIED), which only MMIO can tell.
+        void write(bool fixed, uint16_t address, bool modify = false) {
+            vector<size_t> slow;
+            e.mem({0x8B}, RDX, RSP, WRITE_PAGES, true);                           //mov rdx, [rsp + WRITE_PAGES]
+            if (fixed) {
+                e.mem({0x8B}, RDX, RDX, (address >> 8) * 8, true);               //mov rdx, [rdx + page * 8]
+                e.reg({0x85}, RDX, RDX, true);                                    //test rdx, rdx
+                e.jump(JE, slow);
+                e.mem({0x88}, RAX, RDX, address & 0xFF);                         //mov [rdx + low], al
+            } else {
+                e.reg({0x89}, RCX, RSI);                                          //mov esi, ecx
+                e.bytes({0xC1, 0xEE, 0x08});                                      //shr esi, 8
+                e.mem({0x8B}, RDX, RDX, RSI, 8, 0, true);                         //mov rdx, [rdx + rsi * 8]
+                e.reg({0x85}, RDX, RDX, true);                                    //test rdx, rdx
+                e.jump(JE, slow);
+                e.reg({0x0F, 0xB6}, RSI, RCX);                                    //movzx esi, cl
+                e.mem({0x88}, RAX, RDX, RSI, 1, 0);                               //mov [rdx + rsi], al
+            }
+            size_t back = e.code.size();
+            cold.push_back([this, slow, back, fixed, address, modify] {
+                e.bind(slow);
+                if (modify) {
+                    e.mem({0x89}, RCX, RSP, SAVED_ADDRESS);                       //mov [rsp + SAVED_ADDRESS], ecx
+                    e.mem({0x89}, RAX, RSP, SAVED_VALUE);                         //mov [rsp + SAVED_VALUE], eax
+                    e.mem({0x0F, 0xB6}, RDX, RSP, UNMODIFIED);                    //movzx edx, byte [rsp + UNMODIFIED]
+                    pass_address(fixed, address);
+                    e.reg({0x89}, R12, RDI, true);                                //mov rdi, r12
+                    store_clock();
+                    call(reinterpret_cast<const void *>(write_slow));
+                    e.mem({0x8B}, RCX, RSP, SAVED_ADDRESS);                       //mov ecx, [rsp + SAVED_ADDRESS]
+                    e.mem({0x8B}, RAX, RSP, SAVED_VALUE);                         //mov eax, [rsp + SAVED_VALUE]
+                }
+                e.reg({0x0F, 0xB6}, RDX, RAX);                                    //movzx edx, al
+                pass_address(fixed, address);
+                e.reg({0x89}, R12, RDI, true);                                    //mov rdi, r12
+                store_clock();
+                call(reinterpret_cast<const void *>(write_slow));
+                leave_on_interrupt_or_stall();
+                e.jump_to(back);
+            });
+        }
+
+        void pass_address(bool fixed, uint16_t address) {
+            if (fixed) {
+                e.imm8(0xBE);                                                     //mov esi, address
+                e.imm32(address);
+            } else {
+                e.reg({0x89}, RCX, RSI);                                          //mov esi, ecx
+            }
+        }
+
+        void load_reg(int32_t offset) {
+            e.mem({0x0F, 0xB6}, RAX, RBP, offset);                                //movzx eax, byte [rbp + offset]
+        }
+
+        void store_reg(int32_t offset, int source = RAX) {
+            e.mem({0x88}, source, RBP, offset);                                   //mov [rbp + offset], r8
+        }
+
+        //N and Z from a result byte, as Reg::set_nz
+        void set_nz(int source = RAX) {
+            store_reg(reg.n, source);
+            store_reg(reg.z, source);
+        }
+
+        void set_pc(uint16_t pc) {
+            e.bytes({0x66});
+            e.mem({0xC7}, 0, RBP, reg.pc);                                        //mov word [rbp + pc], imm16
+            e.imm16(pc);
+        }
+
+        void spend(int cycles) {
+            e.bytes({0x49, 0x83, 0xED, static_cast<uint8_t>(cycles)});           //sub r13, imm8
+        }
+
+        //Reads take one more cycle when indexing crossed a page, which is when the effective
+        //address (ecx) ends up below the base in its low byte
+        void spend_page_crossing(Mode mode, uint16_t operand) {
+            if (mode == Mode::INDY) {
+                e.mem({0x3A}, RCX, RSP, POINTER_LOW);                             //cmp cl, [rsp + POINTER_LOW]
+            } else {
+                e.bytes({0x80, 0xF9, static_cast<uint8_t>(operand)});             //cmp cl, low
+            }
+            e.bytes({0x49, 0x83, 0xDD, 0x00});                                    //sbb r13, 0
+        }
+
+        //The effective address into ecx for the indexed and indirect modes. Returns false for
+        //zp and abs, whose address is fixed.
+        bool resolve(Mode mode, uint16_t operand) {
+            switch (mode) {
+                case Mode::ZPX:
+                case Mode::ZPY:
+                    e.mem({0x0F, 0xB6}, RCX, RBP, mode == Mode::ZPX ? reg.x : reg.y); //movzx ecx, byte [rbp + index]
+                    e.bytes({0x80, 0xC1, static_cast<uint8_t>(operand)});         //add cl, imm8
+                    return true;
+                case Mode::ABSX:
+                case Mode::ABSY:
+                    e.mem({0x0F, 0xB6}, RCX, RBP, mode == Mode::ABSX ? reg.x : reg.y); //movzx ecx, byte [rbp + index]
+                    e.bytes({0x81, 0xC1});                                        //add ecx, imm32
+                    e.imm32(operand);
+                    e.reg({0x0F, 0xB7}, RCX, RCX);                                //movzx ecx, cx
+                    return true;
+                case Mode::INDX:
+                case Mode::INDY:
+                    if (mode == Mode::INDX) {
+                        e.mem({0x0F, 0xB6}, RCX, RBP, reg.x);                    //movzx ecx, byte [rbp + x]
+                        e.bytes({0x80, 0xC1, static_cast<uint8_t>(operand)});     //add cl, imm8
+                    } else {
+                        e.imm8(0xB9);                                             //mov ecx, imm32
+                        e.imm32(operand & 0xFF);
+                    }
+                    //The pointer wraps within page 0
+                    read(false, 0);
+                    e.mem({0x89}, RAX, RSP, POINTER_LOW);                         //mov [rsp + POINTER_LOW], eax
+                    e.bytes({0x80, 0xC1, 0x01});                                  //add cl, 1
+                    read(false, 0);
+                    e.bytes({0xC1, 0xE0, 0x08});                                  //shl eax, 8
+                    e.mem({0x0B}, RAX, RSP, POINTER_LOW);                         //or eax, [rsp + POINTER_LOW]
+                    if (mode == Mode::INDX) {
+                        e.reg({0x89}, RAX, RCX);                                  //mov ecx, eax
+                        return true;
+                    }
+                    e.mem({0x0F, 0xB6}, RCX, RBP, reg.y);                        //movzx ecx, byte [rbp + y]
+                    e.reg({0x01}, RAX, RCX);                                      //add ecx, eax
+                    e.reg({0x0F, 0xB7}, RCX, RCX);                                //movzx ecx, cx
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        //The operand value into eax
+        void fetch(Mode mode, Access access, uint16_t operand, bool &indexed, uint16_t &address) {
+            if (mode == Mode::IMM) {
+                e.imm8(0xB8);                                                     //mov eax, imm32
+                e.imm32(operand & 0xFF);
+                return;
+            }
+            if (mode == Mode::ACC) {
+                load_reg(reg.a);
+                return;
+            }
+            address = mode == Mode::ZP ? operand & 0xFF : operand;
+            indexed = resolve(mode, operand);
+            read(!indexed, address);
+            if (access == Access::READ && (mode == Mode::ABSX || mode == Mode::ABSY || mode == Mode::INDY))
+                spend_page_crossing(mode, operand);
+        }
+
+        //A + value (eax) + C, as Cpu6502_State::add; SBC adds the complement
+        void add_with_carry() {
+            e.reg({0x89}, RAX, RSI);                                              //mov esi, eax
+            e.mem({0x0F, 0xB6}, RCX, RBP, reg.a);                                 //movzx ecx, byte [rbp + a]
+            e.mem({0x0F, 0xB6}, RDX, RBP, reg.c + 1);                            //movzx edx, byte [rbp + c + 1]
+            e.bytes({0x83, 0xE2, 0x01});                                          //and edx, 1
+            e.reg({0x01}, RCX, RDX);                                              //add edx, ecx
+            e.reg({0x01}, RSI, RDX);                                              //add edx, esi
+            e.bytes({0x66});
+            e.mem({0x89}, RDX, RBP, reg.c);                                       //mov [rbp + c], dx
+            store_reg(reg.a, RDX);
+            set_nz(RDX);
+            e.reg({0x31}, RDX, RCX);                                              //xor ecx, edx
+            e.reg({0x31}, RDX, RSI);                                              //xor esi, edx
+            e.reg({0x21}, RSI, RCX);                                              //and ecx, esi
+            store_reg(reg.v, RCX);
+        }
+
+        //A, X or Y - value (eax), as CMP/CPX/CPY
+        void compare(int32_t source) {
+            e.mem({0x0F, 0xB6}, RDX, RBP, source);                                //movzx edx, byte [rbp + source]
+            e.reg({0x29}, RAX, RDX);                                              //sub edx, eax
+            set_nz(RDX);
+            e.bytes({0x81, 0xC2});                                                //add edx, 0x100
+            e.imm32(0x100);
+            e.bytes({0x66});
+            e.mem({0x89}, RDX, RBP, reg.c);                                       //mov [rbp + c], dx
+        }
+
+        //The read-modify-write operations on eax, leaving the result in al
+        void modify(Kind kind) {
+            switch (kind) {
+                case Kind::ASL:
+                    e.reg({0x01}, RAX, RAX);                                      //add eax, eax
+                    e.bytes({0x66});
+                    e.mem({0x89}, RAX, RBP, reg.c);                               //mov [rbp + c], ax
+                    break;
+                case Kind::LSR:
+                    e.reg({0x89}, RAX, RDX);                                      //mov edx, eax
+                    e.bytes({0xC1, 0xE2, 0x08});                                  //shl edx, 8
+                    e.bytes({0x66});
+                    e.mem({0x89}, RDX, RBP, reg.c);                               //mov [rbp + c], dx
+                    e.bytes({0xD1, 0xE8});                                        //shr eax, 1
+                    break;
+                case Kind::ROL:
+                    e.mem({0x0F, 0xB6}, RDX, RBP, reg.c + 1);                    //movzx edx, byte [rbp + c + 1]
+                    e.bytes({0x83, 0xE2, 0x01});                                  //and edx, 1
+                    e.mem({0x8D}, RAX, RDX, RAX, 2, 0);                           //lea eax, [rdx + rax * 2]
+                    e.bytes({0x66});
+                    e.mem({0x89}, RAX, RBP, reg.c);                               //mov [rbp + c], ax
+                    break;
+                case Kind::ROR:
+                    e.mem({0x0F, 0xB6}, RDX, RBP, reg.c + 1);                    //movzx edx, byte [rbp + c + 1]
+                    e.bytes({0x83, 0xE2, 0x01});                                  //and edx, 1
+                    e.bytes({0xC1, 0xE2, 0x07});                                  //shl edx, 7
+                    e.reg({0x89}, RAX, RSI);                                      //mov esi, eax
+                    e.bytes({0xC1, 0xE6, 0x08});                                  //shl esi, 8
+                    e.bytes({0x66});
+                    e.mem({0x89}, RSI, RBP, reg.c);                               //mov [rbp + c], si
+                    e.bytes({0xD1, 0xE8});                                        //shr eax, 1
+                    e.reg({0x09}, RDX, RAX);                                      //or eax, edx
+                    break;
+                case Kind::INC:
+                    e.bytes({0xFF, 0xC0});                                        //inc eax
+                    break;
+                default:
+                    e.bytes({0xFF, 0xC8});                                        //dec eax
+                    break;
+            }
+            set_nz();
+        }
+
+        //Branches end their block, so both ways just set PC
+        void branch(const DecodedInstruction &instr, Kind kind) {
+            vector<size_t> not_taken;
+            set_pc(instr.next_pc);
+            spend(2);
+            bool set;
+            switch (kind) {
+                case Kind::BNE:
+                case Kind::BEQ:
+                    //Z is set when z_src is 0
+                    e.mem({0x80}, 7, RBP, reg.z);                                 //cmp byte [rbp + z], 0
+                    e.imm8(0);
+                    set = kind == Kind::BEQ;
+                    e.jump(set ? JNE : JE, not_taken);
+                    break;
+                default: {
+                    int32_t offset = kind == Kind::BCC || kind == Kind::BCS ? reg.c + 1 :
+                                     kind == Kind::BVC || kind == Kind::BVS ? reg.v : reg.n;
+                    uint8_t mask = kind == Kind::BCC || kind == Kind::BCS ? 0x01 : 0x80;
+                    e.mem({0xF6}, 0, RBP, offset);                                //test byte [rbp + offset], mask
+                    e.imm8(mask);
+                    set = kind == Kind::BMI || kind == Kind::BVS || kind == Kind::BCS;
+                    e.jump(set ? JE : JNE, not_taken);
+                    break;
+                }
+            }
+            uint16_t target = static_cast<uint16_t>(instr.next_pc + static_cast<int8_t>(instr.operand));
+            set_pc(target);
+            spend((target & 0xFF00) != (instr.next_pc & 0xFF00) ? 2 : 1);
+            e.bind(not_taken);
+        }
+
+        void instruction(const DecodedInstruction &instr) {
+            const Compiled &how = compiled[instr.opcode];
+            if (how.kind == Kind::CALL) {
+                call_handler(instr);
+                return;
+            }
+            if (how.kind >= Kind::BPL && how.kind <= Kind::BEQ) {
+                branch(instr, how.kind);
+                return;
+            }
+            if (how.kind == Kind::JMP) {
+                set_pc(instr.operand);
+                spend(how.cycles);
+                return;
+            }
+            set_pc(instr.next_pc);
+            bool indexed = false;
+            uint16_t address = 0;
+            switch (how.kind) {
+                case Kind::LDA:
+                case Kind::LDX:
+                case Kind::LDY:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    store_reg(how.kind == Kind::LDA ? reg.a : how.kind == Kind::LDX ? reg.x : reg.y);
+                    set_nz();
+                    break;
+                case Kind::STA:
+                case Kind::STX:
+                case Kind::STY:
+                    address = how.mode == Mode::ZP ? instr.operand & 0xFF : instr.operand;
+                    indexed = resolve(how.mode, instr.operand);
+                    load_reg(how.kind == Kind::STA ? reg.a : how.kind == Kind::STX ? reg.x : reg.y);
+                    write(!indexed, address);
+                    break;
+                case Kind::ORA:
+                case Kind::AND:
+                case Kind::EOR:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    e.mem({static_cast<uint8_t>(how.kind == Kind::ORA ? 0x0A : how.kind == Kind::AND ? 0x22 : 0x32)},
+                          RAX, RBP, reg.a);                                       //or/and/xor al, [rbp + a]
+                    store_reg(reg.a);
+                    set_nz();
+                    break;
+                case Kind::ADC:
+                case Kind::SBC:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    if (how.kind == Kind::SBC)
+                        e.bytes({0x34, 0xFF});                                    //xor al, 0xFF
+                    add_with_carry();
+                    break;
+                case Kind::CMP:
+                case Kind::CPX:
+                case Kind::CPY:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    compare(how.kind == Kind::CMP ? reg.a : how.kind == Kind::CPX ? reg.x : reg.y);
+                    break;
+                case Kind::BIT:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    store_reg(reg.n);
+                    e.mem({0x8A}, RDX, RBP, reg.a);                               //mov dl, [rbp + a]
+                    e.reg({0x20}, RAX, RDX);                                      //and dl, al
+                    store_reg(reg.z, RDX);
+                    e.reg({0x00}, RAX, RAX);                                      //add al, al
+                    store_reg(reg.v);
+                    break;
+                case Kind::ASL:
+                case Kind::LSR:
+                case Kind::ROL:
+                case Kind::ROR:
+                case Kind::INC:
+                case Kind::DEC:
+                    fetch(how.mode, access_of(how.kind), instr.operand, indexed, address);
+                    if (how.mode != Mode::ACC)
+                        e.mem({0x89}, RAX, RSP, UNMODIFIED);                      //mov [rsp + UNMODIFIED], eax
+                    modify(how.kind);
+                    if (how.mode == Mode::ACC)
+                        store_reg(reg.a);
+                    else
+                        write(!indexed, address, true);
+                    break;
+                default:
+                    implied(how.kind);
+                    break;
+            }
+            //After the accesses, which see the clock as the instruction started
+            spend(how.cycles);
+        }
+
+        void implied(Kind kind) {
+            switch (kind) {
+                case Kind::INX:
+                case Kind::INY:
+                case Kind::DEX:
+                case Kind::DEY: {
+                    int32_t target = kind == Kind::INX || kind == Kind::DEX ? reg.x : reg.y;
+                    load_reg(target);
+                    if (kind == Kind::INX || kind == Kind::INY)
+                        e.bytes({0xFF, 0xC0});                                    //inc eax
+                    else
+                        e.bytes({0xFF, 0xC8});                                    //dec eax
+                    store_reg(target);
+                    set_nz();
+                    break;
+                }
+                case Kind::TAX:
+                case Kind::TAY:
+                case Kind::TXA:
+                case Kind::TYA:
+                case Kind::TSX:
+                case Kind::TXS: {
+                    int32_t from = kind == Kind::TAX || kind == Kind::TAY ? reg.a :
+                                   kind == Kind::TXA || kind == Kind::TXS ? reg.x :
+                                   kind == Kind::TYA ? reg.y : reg.s;
+                    int32_t to = kind == Kind::TAX || kind == Kind::TSX ? reg.x :
+                                 kind == Kind::TAY ? reg.y :
+                                 kind == Kind::TXS ? reg.s : reg.a;
+                    load_reg(from);
+                    store_reg(to);
+                    if (kind != Kind::TXS)
+                        set_nz();
+                    break;
+                }
+                case Kind::CLC:
+                case Kind::SEC:
+                    e.bytes({0x66});
+                    e.mem({0xC7}, 0, RBP, reg.c);                                 //mov word [rbp + c], imm16
+                    e.imm16(kind == Kind::SEC ? 0x100 : 0);
+                    break;
+                case Kind::CLV:
+                    e.mem({0xC6}, 0, RBP, reg.v);                                 //mov byte [rbp + v], 0
+                    e.imm8(0);
+                    break;
+                case Kind::CLD:
+                case Kind::CLI:
+                    e.mem({0x80}, 4, RBP, reg.p);                                 //and byte [rbp + p], imm8
+                    e.imm8(kind == Kind::CLD ? 0xF7 : 0xFB);
+                    break;
+                case Kind::SED:
+                case Kind::SEI:
+                    e.mem({0x80}, 1, RBP, reg.p);                                 //or byte [rbp + p], imm8
+                    e.imm8(kind == Kind::SED ? 0x08 : 0x04);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        //Anything not compiled inline runs its replay handler, as the interpreter would
+        void call_handler(const DecodedInstruction &instr) {
+            store_clock();
+            e.reg({0x89}, R12, RDI, true);                                        //mov rdi, r12
+            e.bytes({0x48, 0xBE});                                                //mov rsi, &instr
+            e.imm64(reinterpret_cast<uint64_t>(&instr));
+            call(reinterpret_cast<const void *>(instr.replay));
+            e.bytes({0x48, 0x98});                                                //cdqe
+            e.reg({0x29}, RAX, R13, true);                                        //sub r13, rax
+            leave_on_interrupt_or_stall();
+        }
+
+        const RegLayout &reg;
+        Emitter e;
+        vector<size_t> exit, stopped;
+        //Slow paths, emitted after the block so the straight line stays short
+        vector<function<void()>> cold;
+    };
+}
+#endif
+
+Jit::~Jit() {
+#ifdef NESEMULATOR_HAS_JIT
+    if (arena) {
+        munmap(arena, ARENA_SIZE);
+        munmap(arena_writable, ARENA_SIZE);
+    }
+#endif
+}
+
+const void *Jit::enter(const BlockCache &cache, BlockCache::Block &block) {
+    //The cache dropped its blocks, so nothing can reach the native code compiled for them
+    if (cache.generation() != generation) {
+        reset();
+        generation = cache.generation();
+    }
+    if (block.compiled)
+        return block.compiled;
+    if (++block.entries < hot_entries || block.length < min_length || unavailable || out_of_space)
+        return nullptr;
+    block.compiled = compile(cache.code(block));
+    return block.compiled;
+}
+
+bool Jit::run(const void *code, JitFrame &frame) {
+#ifdef NESEMULATOR_HAS_JIT
+    using Block = int (*)(JitFrame *, const uint8_t *const *, Reg *, uint8_t *const *);
+    auto block = reinterpret_cast<Block>(const_cast<void *>(code));
+    Memory &memory = frame.state->mem();
+    return block(&frame, memory.read_pages.data(), &frame.state->reg(), memory.write_pages.data()) != 0;
+#else
+    return false;
+#endif
+}
+
+void Jit::reset() {
+    used = 0;
+    out_of_space = false;
+}
+
+const void *Jit::compile(span<const DecodedInstruction> code) {
+#ifdef NESEMULATOR_HAS_JIT
+    if (!arena && !map_arena()) {
+        unavailable = true;
+        return nullptr;
+    }
+
+    RegLayout layout = {offsetof(Reg, A), offsetof(Reg, X), offsetof(Reg, Y), offsetof(Reg, PC), offsetof(Reg, S),
+                        offsetof(Reg, P), offsetof(Reg, n_src), offsetof(Reg, z_src), offsetof(Reg, c_src),
+                        offsetof(Reg, v_src)};
+    vector<uint8_t> native = Compiler(layout).compile(code);
+    if (used + native.size() > ARENA_SIZE) {
+        out_of_space = true;
+        return nullptr;
+    }
+    //Written through the RW view, run from the RX one; the code is position independent
+    //apart from absolute calls out
+    memcpy(arena_writable + used, native.data(), native.size());
+    uint8_t *block = arena + used;
+    //Blocks start on 16 bytes, as compilers align functions
+    used = (used + native.size() + 15) & ~size_t(15);
+    compiled++;
+    return block;
+#else
+    unavailable = true;
+    return nullptr;
+#endif
+}
+
+#ifdef NESEMULATOR_HAS_JIT
+bool Jit::map_arena() {
+    //One memfd mapped twice, so no page is ever writable and executable at once and adding a
+    //block costs no mprotect (nor the TLB flush that comes with it)
+    int fd = memfd_create("nes-jit", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool sized = ftruncate(fd, ARENA_SIZE) == 0;
+    void *writable = sized ? mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    void *executable = writable != MAP_FAILED ? mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0)
+                                              : MAP_FAILED;
+    //The mappings keep the memory alive
+    close(fd);
+    if (executable == MAP_FAILED) {
+        if (writable != MAP_FAILED)
+            munmap(writable, ARENA_SIZE);
+        return false;
+    }
+    arena_writable = static_cast<uint8_t *>(writable);
+    arena = static_cast<uint8_t *>(executable);
+    return true;
+}
+#endif
@@ -0,0 +1,118 @@
+#ifndef NESEMULATOR_JIT_H
+#define NESEMULATOR_JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "block_cache.h"
+#include "state.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+//Native code is emitted for the System V x86-64 calling convention
+#define NESEMULATOR_HAS_JIT 1
+#endif
+
+//Asked after each instruction a compiled block runs; returning true stops the run
+typedef bool (*JitStop)(void *context, Cpu6502_State &state);
+
+//What a compiled block runs with; budget and opcode are kept up to date as it goes
+struct JitFrame {
+    Cpu6502_State *state;
+    //The CPU's clock, set at the start of each instruction that may reach MMIO
+    uint64_t *clock;
+    const InterruptLines *lines;
+    //Scheduler::pending_stall(); the interpreter loop charges DMA stalls, so any ends the run
+    const uint32_t *stall;
+    //Null when nothing stops the run early
+    JitStop stop;
+    void *stop_context;
+    uint64_t deadline;
+    //Cycles left before the deadline, and the budget at which the next event falls due
+    int64_t budget;
+    int64_t event_budget;
+    //Both interrupt lines as the block was entered. An IRQ that was masked then stays masked
+    //for the whole block (CLI and PLP end blocks), so only a change needs a look.
+    uint16_t entry_lines;
+    //The last opcode run
+    uint8_t opcode;
+};
+
+//Compiles blocks of the block cache that are entered often to x86-64 (CpuMode::JIT). Loads,
+//stores, ALU ops, shifts, transfers, flag ops, branches and JMP are compiled inline: they
+//work on Reg in place and reach plain pages straight through Memory's page tables, leaving
+//only MMIO to Memory and its handlers. Everything else calls its replay handler with the
+//decoded operand built in. Between instructions it keeps the budget and leaves as soon as
+//the interpreter loop would have to do something: the budget is spent, an event is due, an
+//interrupt line changes, DMA stalls the CPU or stop holds. The arena is never writable and
+//executable at once: it's one memfd mapped twice, written through an RW view and run from an
+//RX one.
+//Blocks already end at writes that could change code (see block_cache.h) and are
+//revalidated by the cache on each entry, so self-modifying code and bank switches never run
+//stale native code.
+class Jit {
+public:
+    //Times a block is entered before it's compiled, by default
+    static constexpr uint32_t HOT_ENTRIES = 16;
+    //Shorter blocks replay faster than the call into native code and back
+    static constexpr int MIN_LENGTH = 4;
+    static constexpr size_t ARENA_SIZE = 4 << 20;
+
+    Jit() = default;
+
+    ~Jit();
+
+    Jit(const Jit &) = delete;
+
+    Jit &operator=(const Jit &) = delete;
+
+    //Counts an entry into block, compiling it once it's hot. Returns its native code, or
+    //null while it's cold or when it can't be compiled (not x86-64, no executable memory).
+    //The code refers to the cache's decoded instructions; see full(). Once the cache has
+    //dropped its blocks (BlockCache::generation) the arena is reused from the start.
+    const void *enter(const BlockCache &cache, BlockCache::Block &block);
+
+    //When blocks get compiled; (1, 1) compiles every block on its first entry, as a test
+    //harness wants
+    void set_thresholds(uint32_t entries, int length) {
+        hot_entries = entries;
+        min_length = length;
+    }
+
+    //Runs native code from enter(). Returns whether frame.stop ended the run.
+    static bool run(const void *code, JitFrame &frame);
+
+    //Out of room: the block cache has to be cleared, then reset() called, before any more
+    //blocks are compiled
+    [[nodiscard]] bool full() const {
+        return out_of_space;
+    }
+
+    //Forgets all native code. Whatever still points at it must be gone (BlockCache::clear).
+    void reset();
+
+    [[nodiscard]] uint64_t compiled_count() const {
+        return compiled;
+    }
+
+private:
+    const void *compile(std::span<const DecodedInstruction> code);
+
+#ifdef NESEMULATOR_HAS_JIT
+    bool map_arena();
+#endif
+
+    uint32_t hot_entries = HOT_ENTRIES;
+    int min_length = MIN_LENGTH;
+    //Where native code runs from (RX), and the same memory mapped again to write it (RW)
+    uint8_t *arena = nullptr;
+    uint8_t *arena_writable = nullptr;
+    size_t used = 0;
+    //BlockCache::generation() the arena's code was compiled for
+    uint64_t generation = 0;
+    bool out_of_space = false;
+    //Set once mapping the arena has failed
+    bool unavailable = false;
+    uint64_t compiled = 0;
+};
+
+#endif //NESEMULATOR_JIT_H
@@ -0,0 +1,169 @@
+#include "json_tests.h"
+#include <stdexcept>
+
+using namespace std;
+
+//The layout being followed, by depth:
+//  1  [ case, ... ]
+//  2  { "name": ..., "initial": state, "final": state, "cycles": [...] }
+//  3  state: { "pc": ..., ..., "ram": [...] }, or the cycles array
+//  4  the ram array, or one [address, value, "read"|"write"] cycle
+//  5  one [address, value] ram entry
+
+JsonTestReader::JsonTestReader(bool with_cycles, TestCaseCallback callback, void *context)
+        : with_cycles(with_cycles), callback(callback), context(context) {
+}
+
+size_t JsonTestReader::read(istream &stream) {
+    cases = 0;
+    depth = 0;
+    nlohmann::json::sax_parse(stream, this);
+    return cases;
+}
+
+bool JsonTestReader::null() {
+    return true;
+}
+
+bool JsonTestReader::boolean(bool value) {
+    return true;
+}
+
+bool JsonTestReader::number_integer(number_integer_t value) {
+    number(static_cast<uint64_t>(value));
+    return true;
+}
+
+bool JsonTestReader::number_unsigned(number_unsigned_t value) {
+    number(value);
+    return true;
+}
+
+bool JsonTestReader::number_float(number_float_t value, const string_t &text) {
+    return true;
+}
+
+bool JsonTestReader::string(string_t &value) {
+    if (depth == 2 && section == Section::NAME)
+        test.name = value;
+    else if (depth == 4 && section == Section::CYCLES && element++ == 2)
+        cycle.write = value == "write";
+    return true;
+}
+
+bool JsonTestReader::binary(binary_t &value) {
+    return true;
+}
+
+bool JsonTestReader::start_object(size_t elements) {
+    depth++;
+    if (depth == 2) {
+        test.name.clear();
+        test.initial = test.final = {};
+        test.initial_ram.clear();
+        test.final_ram.clear();
+        test.cycles.clear();
+        section = Section::OTHER;
+    }
+    return true;
+}
+
+bool JsonTestReader::key(string_t &name) {
+    if (depth == 2) {
+        if (name == "name")
+            section = Section::NAME;
+        else if (name == "initial")
+            section = Section::INITIAL;
+        else if (name == "final")
+            section = Section::FINAL;
+        else if (name == "cycles")
+            section = Section::CYCLES;
+        else
+            section = Section::OTHER;
+    } else if (depth == 3) {
+        static const pair<const char *, Field> fields[] = {
+                {"pc", Field::PC}, {"s", Field::S}, {"a", Field::A}, {"x", Field::X},
+                {"y", Field::Y}, {"p", Field::P}, {"ram", Field::RAM}
+        };
+        field = Field::OTHER;
+        for (const auto &[text, value] : fields) {
+            if (name == text)
+                field = value;
+        }
+    }
+    return true;
+}
+
+bool JsonTestReader::end_object() {
+    if (depth == 2) {
+        callback(context, test);
+        cases++;
+    }
+    depth--;
+    return true;
+}
+
+bool JsonTestReader::start_array(size_t elements) {
+    depth++;
+    element = 0;
+    return true;
+}
+
+bool JsonTestReader::end_array() {
+    bool in_state = section == Section::INITIAL || section == Section::FINAL;
+    if (depth == 5 && in_state && field == Field::RAM)
+        (section == Section::INITIAL ? test.initial_ram : test.final_ram).push_back(ram_entry);
+    else if (depth == 4 && section == Section::CYCLES && with_cycles)
+        test.cycles.push_back(cycle);
+    depth--;
+    return true;
+}
+
+bool JsonTestReader::parse_error(size_t position, const std::string &last_token,
+                                 const nlohmann::detail::exception &error) {
+    throw runtime_error(error.what());
+}
+
+void JsonTestReader::number(uint64_t value) {
+    if (depth == 3 && (section == Section::INITIAL || section == Section::FINAL)) {
+        CpuRecord &regs = state();
+        switch (field) {
+            case Field::PC:
+                regs.pc = static_cast<uint16_t>(value);
+                break;
+            case Field::S:
+                regs.s = static_cast<uint8_t>(value);
+                break;
+            case Field::A:
+                regs.a = static_cast<uint8_t>(value);
+                break;
+            case Field::X:
+                regs.x = static_cast<uint8_t>(value);
+                break;
+            case Field::Y:
+                regs.y = static_cast<uint8_t>(value);
+                break;
+            case Field::P:
+                regs.p = static_cast<uint8_t>(value);
+                break;
+            default:
+                break;
+        }
+    } else if (depth == 5 && field == Field::RAM) {
+        if (element == 0)
+            ram_entry.address = static_cast<uint16_t>(value);
+        else if (element == 1)
+            ram_entry.value = static_cast<uint8_t>(value);
+        element++;
+    } else if (depth == 4 && section == Section::CYCLES) {
+        if (element == 0)
+            cycle.address = static_cast<uint16_t>(value);
+        else if (element == 1)
+            cycle.value = static_cast<uint8_t>(value);
+        element++;
+    }
+}
+
+CpuRecord &JsonTestReader::state() {
+    return section == Section::INITIAL ? test.initial : test.final;
+}
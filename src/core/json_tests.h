@@ -0,0 +1,82 @@
+#ifndef NESEMULATOR_JSON_TESTS_H
+#define NESEMULATOR_JSON_TESTS_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "test_vectors.h"
+
+//Called with each case as soon as it has been read. The case is reused for the next one,
+//so anything kept must be copied out.
+typedef void (*TestCaseCallback)(void *context, const TestCase &test);
+
+//SAX handler for a ProcessorTests JSON file (an array of case objects). Nothing but the
+//case being read is held in memory, whatever the size of the file.
+class JsonTestReader : public nlohmann::json_sax<nlohmann::json> {
+public:
+    //The bus activity ("cycles") is skipped unless with_cycles is set
+    JsonTestReader(bool with_cycles, TestCaseCallback callback, void *context);
+
+    //Reads the whole stream; throws on malformed JSON. Returns the number of cases.
+    size_t read(std::istream &stream);
+
+    bool null() override;
+
+    bool boolean(bool value) override;
+
+    bool number_integer(number_integer_t value) override;
+
+    bool number_unsigned(number_unsigned_t value) override;
+
+    bool number_float(number_float_t value, const string_t &text) override;
+
+    bool string(string_t &value) override;
+
+    bool binary(binary_t &value) override;
+
+    bool start_object(std::size_t elements) override;
+
+    bool key(string_t &name) override;
+
+    bool end_object() override;
+
+    bool start_array(std::size_t elements) override;
+
+    bool end_array() override;
+
+    bool parse_error(std::size_t position, const std::string &last_token,
+                     const nlohmann::detail::exception &error) override;
+
+private:
+    //Where a case object's key leads
+    enum class Section {
+        OTHER, NAME, INITIAL, FINAL, CYCLES
+    };
+
+    //Where a state object's key leads
+    enum class Field {
+        OTHER, PC, S, A, X, Y, P, RAM
+    };
+
+    void number(uint64_t value);
+
+    [[nodiscard]] CpuRecord &state();
+
+    bool with_cycles;
+    TestCaseCallback callback;
+    void *context;
+    size_t cases = 0;
+
+    TestCase test;
+    //1 inside the top-level array, 2 inside a case, and so on
+    int depth = 0;
+    Section section = Section::OTHER;
+    Field field = Field::OTHER;
+    //Position within the innermost [address, value(, kind)] array
+    int element = 0;
+    RamEntry ram_entry = {};
+    BusCycle cycle = {};
+};
+
+#endif //NESEMULATOR_JSON_TESTS_H
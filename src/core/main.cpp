@@ -1,119 +1,294 @@
 #include <iostream>
 #include "cpu.cpp"
 #include <fstream>
-#include <nlohmann/json.hpp>
 #include "instructions.h"
 #include <filesystem>
+#include "capture.h"
+#include "work_pool.h"
+#include "test_vectors.h"
+#include "json_tests.h"
+#include <map>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 
 
-using json = nlohmann::json;
 
-void print_ram(const json &ram) {
-    // Create a vector of pairs to store the addresses and values
-    vector<pair<int, int>> sorted_ram;
-    for (auto &entry: ram) {
-        auto addr = entry[0].get<int>();
-        auto val = entry[1].get<int>();
-        sorted_ram.emplace_back(addr, val);
-    }
-
-    // Sort the vector by address
-    sort(sorted_ram.begin(), sorted_ram.end());
+void print_ram(span<const RamEntry> ram, ostream &out) {
+    // Sort by address
+    vector<RamEntry> sorted_ram(ram.begin(), ram.end());
+    sort(sorted_ram.begin(), sorted_ram.end(), [](const RamEntry &a, const RamEntry &b) {
+        return a.address < b.address;
+    });
 
     // Print the sorted RAM values
     for (const auto &entry: sorted_ram) {
-        auto addr = entry.first;
-        auto val = entry.second;
-        cerr << "RAM Address: 0x" << hex << addr << " (" << dec << addr << ")"
-             << ", Value: 0x" << hex << val << " (" << dec << val << ")" << endl;
+        int addr = entry.address;
+        int val = entry.value;
+        out << "RAM Address: 0x" << hex << addr << " (" << dec << addr << ")"
+            << ", Value: 0x" << hex << val << " (" << dec << val << ")" << endl;
     }
 }
 
-//see: https://github.com/SingleStepTests/ProcessorTests/tree/main/nes6502
-void test_json(string file_str) {
-    std::ifstream file(file_str);
-    json jsonObject;
-    file >> jsonObject;
-    string PAUSE_ON = "08 60 be";
-    for (auto &obj: jsonObject) {
-        auto initial = obj["initial"];
-        Cpu6502 cpu;
-        cpu.power();
-        string name = obj["name"];
-        if (name == PAUSE_ON) {
-            cout << "BREAKPOINT" << endl;
-        }
-        cpu.reg().setPC(Addr(initial["pc"].get<int>()));
-        cpu.reg().setS(Val(initial["s"].get<int>()));
-        cpu.reg().setA(Val(initial["a"].get<int>()));
-        cpu.reg().setX(Val(initial["x"].get<int>()));
-        cpu.reg().setY(Val(initial["y"].get<int>()));
-        cpu.reg().setP(Val(initial["p"].get<int>()));
-        auto ram = initial["ram"];
-        for (auto &entry: ram) {
-            auto addr = entry[0].get<int>();
-            auto val = entry[1].get<int>();
-            cpu.mem().write_byte(addr, val);
+void print_registers(const CpuRecord &regs, ostream &out) {
+    out << "pc=" << (int) regs.pc << " s=" << (int) regs.s << " a=" << (int) regs.a << " x=" << (int) regs.x
+        << " y=" << (int) regs.y << " p=" << (int) regs.p << endl;
+}
+
+//How the harness runs each case; set once from the command line, before any worker starts
+CpuMode harness_mode = CpuMode::INSTRUCTION_STEPPED;
+
+//One CPU per worker thread, put back to its blank state between cases rather than rebuilt
+Cpu6502 &harness_cpu() {
+    struct Harness {
+        Cpu6502 cpu{harness_mode};
+        CpuSnapshot blank;
+
+        Harness() {
+            //Every case is a single instruction, so a block that waited to get hot never would
+            cpu.jit().set_thresholds(1, 1);
+            cpu.mem().map_flat();
+            cpu.power();
+            blank = cpu.snapshot();
         }
+    };
+    thread_local Harness harness;
+    harness.cpu.reset_to(harness.blank);
+    return harness.cpu;
+}
+
+//Runs one test case; on a mismatch, describes what went wrong in report and returns false
+bool run_case(const TestCaseView &test, string &report) {
+    Cpu6502 &cpu = harness_cpu();
+    cpu.reg().setPC(Addr(test.initial.pc));
+    cpu.reg().setS(Val(test.initial.s));
+    cpu.reg().setA(Val(test.initial.a));
+    cpu.reg().setX(Val(test.initial.x));
+    cpu.reg().setY(Val(test.initial.y));
+    cpu.reg().setP(Val(test.initial.p));
+    for (const RamEntry &entry: test.initial_ram)
+        cpu.mem().write_byte(entry.address, entry.value);
+    if (harness_mode == CpuMode::INSTRUCTION_STEPPED) {
         auto instr = cpu.cpu_state().get_byte(cpu.cpu_state().reg().getPC()).val;
         cpu.cpu_state().reg().incrPC();
-        if (name == PAUSE_ON) {
-            cout << "BREAKPOINT" << endl;
-        }
-        auto cycles = instructions[instr]->act(cpu.cpu_state());
-        auto final = obj["final"];
+        instructions[instr](cpu.cpu_state());
+    } else {
+        //Through the engine's own loop; a one cycle budget runs exactly one instruction
+        cpu.run_cycles(1);
+    }
+    const CpuRecord &final = test.final;
 
-        try {
-            if (cpu.reg().getPC().addr != final["pc"].get<int>()) {
-                throw runtime_error("PC mismatch");
-            }
-            if (cpu.reg().getS().val != final["s"].get<int>()) {
-                throw runtime_error("S mismatch");
-            }
-            if (cpu.reg().getA().val != final["a"].get<int>()) {
-                throw runtime_error("A mismatch");
-            }
-            if (cpu.reg().getX().val != final["x"].get<int>()) {
-                throw runtime_error("X mismatch");
-            }
-            if (cpu.reg().getY().val != final["y"].get<int>()) {
-                throw runtime_error("Y mismatch");
-            }
-            if (cpu.reg().getP().val != final["p"].get<int>()) {
-                throw runtime_error("P mismatch");
-            }
-            auto final_ram = final["ram"];
-            for (auto &entry: final_ram) {
-                auto addr = entry[0].get<int>();
-                auto val = entry[1].get<int>();
-                if (cpu.mem().read_byte(addr) != val) {
-                    throw runtime_error("RAM mismatch at address " + to_string(addr));
-                }
+    try {
+        if (cpu.reg().getPC().addr != final.pc) {
+            throw runtime_error("PC mismatch");
+        }
+        if (cpu.reg().getS().val != final.s) {
+            throw runtime_error("S mismatch");
+        }
+        if (cpu.reg().getA().val != final.a) {
+            throw runtime_error("A mismatch");
+        }
+        if (cpu.reg().getX().val != final.x) {
+            throw runtime_error("X mismatch");
+        }
+        if (cpu.reg().getY().val != final.y) {
+            throw runtime_error("Y mismatch");
+        }
+        if (cpu.reg().getP().val != final.p) {
+            throw runtime_error("P mismatch");
+        }
+        for (const RamEntry &entry: test.final_ram) {
+            if (cpu.mem().read_byte(entry.address) != entry.value) {
+                throw runtime_error("RAM mismatch at address " + to_string(entry.address));
             }
-        } catch (const std::exception &e) {
-            cerr << "Test failed for " << name << endl;
-            cerr << "Reason: " << e.what() << endl;
-            cerr << "Initial state: " << initial.dump() << endl;
-            cerr << "Initial ram: " << endl;
-            print_ram(initial["ram"]);
-            cerr << "--------------------------------" << endl;
-            cerr << "--Expected Output--" << endl;
-            cerr << "Final state: " << final.dump() << endl;
-            cerr << "Final ram: " << endl;
-            print_ram(final["ram"]);
-            cerr << "--------------------------------" << endl;
-            cerr << "--User Output--" << endl;
-            cerr << "CPU Registers:" << endl;
-            cerr << "PC: " << (int) cpu.reg().getPC().addr << endl;
-            cerr << "S: " << (int) cpu.reg().getS().val << endl;
-            cerr << "A: " << (int) cpu.reg().getA().val << endl;
-            cerr << "X: " << (int) cpu.reg().getX().val << endl;
-            cerr << "Y: " << (int) cpu.reg().getY().val << endl;
-            cerr << "P: " << (int) cpu.reg().getP().val << endl;
-            assert(false); // Force a failure in the catch block
         }
+    } catch (const std::exception &e) {
+        ostringstream failure;
+        failure << "Test failed for " << test.name << endl;
+        failure << "Reason: " << e.what() << endl;
+        failure << "Initial state: ";
+        print_registers(test.initial, failure);
+        failure << "Initial ram: " << endl;
+        print_ram(test.initial_ram, failure);
+        failure << "--------------------------------" << endl;
+        failure << "--Expected Output--" << endl;
+        failure << "Final state: ";
+        print_registers(final, failure);
+        failure << "Final ram: " << endl;
+        print_ram(test.final_ram, failure);
+        failure << "--------------------------------" << endl;
+        failure << "--User Output--" << endl;
+        failure << "CPU Registers:" << endl;
+        failure << "PC: " << (int) cpu.reg().getPC().addr << endl;
+        failure << "S: " << (int) cpu.reg().getS().val << endl;
+        failure << "A: " << (int) cpu.reg().getA().val << endl;
+        failure << "X: " << (int) cpu.reg().getX().val << endl;
+        failure << "Y: " << (int) cpu.reg().getY().val << endl;
+        failure << "P: " << (int) cpu.reg().getP().val << endl;
+        report = failure.str();
+        return false;
+    }
+    return true;
+}
+
+bool run_case(const TestCase &test, string &report) {
+    return run_case(test.view(), report);
+}
+
+//Pass/fail counts and time spent for one opcode file, filled in by whichever workers ran its cases
+struct FileReport {
+    string path;
+    atomic<size_t> passed = 0;
+    atomic<size_t> failed = 0;
+    //steady_clock nanoseconds from the first of the file's tasks starting (parsing included)
+    //to the last one finishing. They overlap on different workers, so summing would overstate it.
+    atomic<int64_t> first_start = INT64_MAX;
+    atomic<int64_t> last_finish = INT64_MIN;
+    mutex failure_lock;
+    //Details of the first failing case only; the rest are just counted
+    string first_failure;
+
+    void fail(string &&failure) {
+        failed++;
+        lock_guard<mutex> guard(failure_lock);
+        if (first_failure.empty())
+            first_failure = std::move(failure);
+    }
+
+    //A task of this file ran from start to finish
+    void ran(int64_t start, int64_t finish) {
+        int64_t first = first_start.load(memory_order_relaxed);
+        while (start < first && !first_start.compare_exchange_weak(first, start, memory_order_relaxed)) {}
+        int64_t last = last_finish.load(memory_order_relaxed);
+        while (finish > last && !last_finish.compare_exchange_weak(last, finish, memory_order_relaxed)) {}
+    }
+
+    //Only once every task has run
+    [[nodiscard]] int64_t wall_nanoseconds() const {
+        return last_finish - first_start;
+    }
+};
+
+//Cases per task: big enough to amortise the queueing, small enough to spread one slow file
+constexpr size_t CASES_PER_TASK = 500;
+
+int64_t nanoseconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+int64_t now_nanoseconds() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Runs cases [begin, end) of source, which maps an index to something run_case takes
+template<class Source>
+void run_cases(const Source &source, size_t begin, size_t end, FileReport &report) {
+    int64_t start = now_nanoseconds();
+    size_t passed = 0;
+    for (size_t i = begin; i < end; i++) {
+        string failure;
+        if (run_case(source(i), failure))
+            passed++;
+        else
+            report.fail(std::move(failure));
+    }
+    report.passed += passed;
+    report.ran(start, now_nanoseconds());
+}
+
+//Shards cases [0, count) of source into tasks; they start on this worker and get stolen
+//by idle ones. source is shared by the tasks and lives as long as the last of them.
+template<class Source>
+void submit_cases(WorkPool &pool, shared_ptr<const Source> source, size_t count, FileReport &report) {
+    for (size_t begin = 0; begin < count; begin += CASES_PER_TASK) {
+        size_t end = min(count, begin + CASES_PER_TASK);
+        pool.submit([source, begin, end, &report] { run_cases(*source, begin, end, report); });
+    }
+}
+
+//Streams a JSON file, running each case as soon as it's read. Only files are spread over
+//the workers here; holding cases back to shard them would defeat the streaming.
+void run_json_file(FileReport &report) {
+    struct Context {
+        FileReport &report;
+        size_t passed = 0;
+    } context{report};
+    JsonTestReader reader(false, [](void *context, const TestCase &test) {
+        auto &run = *static_cast<Context *>(context);
+        string failure;
+        if (run_case(test, failure))
+            run.passed++;
+        else
+            run.report.fail(std::move(failure));
+    }, &context);
+    std::ifstream file(report.path);
+    if (!file.is_open())
+        throw runtime_error("Can't open " + report.path);
+    reader.read(file);
+    report.passed += context.passed;
+}
+
+//Runs one file: packed test vectors are mapped and sharded over the pool, JSON is streamed
+void run_file(WorkPool &pool, FileReport &report) {
+    int64_t start = now_nanoseconds();
+    try {
+        if (filesystem::path(report.path).extension() == ".tv") {
+            auto vectors = make_shared<const TestVectorFile>(report.path);
+            auto source = [vectors](size_t i) { return (*vectors)[i]; };
+            submit_cases(pool, make_shared<const decltype(source)>(source), vectors->size(), report);
+        } else {
+            run_json_file(report);
+        }
+    } catch (const std::exception &e) {
+        report.fail(string("Can't read tests: ") + e.what() + "\n");
     }
-    cout << "PASSED" << endl;
+    report.ran(start, now_nanoseconds());
+}
+
+//see: https://github.com/SingleStepTests/ProcessorTests/tree/main/nes6502
+//Runs every .json or .tv file in test_dir on threads workers, taking the .tv when a file
+//has both. Prints one line per file, the first failure of each failing file, and the
+//totals; returns whether everything passed.
+bool run_processor_tests(const string &test_dir, unsigned threads) {
+    namespace fs = std::filesystem;
+    map<string, fs::path> files;
+    for (const auto &entry: fs::directory_iterator(test_dir)) {
+        const fs::path &path = entry.path();
+        if (path.extension() == ".tv" || (path.extension() == ".json" && !files.contains(path.stem().string())))
+            files[path.stem().string()] = path;
+    }
+    vector<unique_ptr<FileReport>> reports;
+    for (const auto &[name, path]: files) {
+        reports.push_back(make_unique<FileReport>());
+        reports.back()->path = path.string();
+    }
+
+    auto start = chrono::steady_clock::now();
+    {
+        WorkPool pool(threads);
+        for (auto &report: reports)
+            pool.submit([&pool, report = report.get()] { run_file(pool, *report); });
+        pool.wait();
+    }
+    double seconds = nanoseconds_since(start) / 1e9;
+
+    size_t passed = 0, failed = 0;
+    for (auto &report: reports) {
+        passed += report->passed;
+        failed += report->failed;
+        string name = fs::path(report->path).stem().string();
+        if (report->failed == 0) {
+            cout << name << ": PASSED " << report->passed;
+        } else {
+            cerr << report->first_failure;
+            cout << name << ": FAILED " << report->failed << " of " << report->passed + report->failed;
+        }
+        cout << " (" << fixed << setprecision(1) << report->wall_nanoseconds() / 1e6 << " ms)" << endl;
+    }
+    cout << reports.size() << " files, " << passed << " passed, " << failed << " failed in "
+         << fixed << setprecision(2) << seconds << " s on " << max(threads, 1u) << " threads" << endl;
+    return failed == 0;
 }
 
 void test_sample() {
@@ -129,17 +304,113 @@ void test_sample() {
         cpu.posedge_clock();
 }
 
-int main() {
-    namespace fs = std::filesystem;
-    std::string test_dir = "../tests/v1/";
-
-    // Iterate over all files in the directory
-    for (const auto& entry : fs::directory_iterator(test_dir)) {
-        // Check if the file has a .json extension
-        if (entry.path().extension() == ".json") {
-            std::string filename = entry.path().string();
-            test_json(filename);
+#ifdef NESEMULATOR_PRECOMPILED_ROM
+//From the NESRecompiler output this was built with (NESEMULATOR_PRECOMPILED_ROM in CMake)
+extern const PrecompiledRom precompiled_rom;
+#endif
+
+//Runs rom headless for the given number of frames, recording them and their sound. Either
+//path may be empty.
+void record(const string &rom, uint64_t frames, const string &video_path, const string &audio_path) {
+#ifdef NESEMULATOR_PRECOMPILED_ROM
+    Cpu6502 cpu{CpuMode::PRECOMPILED};
+#else
+    //Decoded code, so the time spent polling in idle loops is skipped
+    Cpu6502 cpu{CpuMode::BLOCK_CACHED};
+#endif
+    cpu.set_threaded_ppu(true);
+    cpu.load_rom(rom);
+#ifdef NESEMULATOR_PRECOMPILED_ROM
+    if (!cpu.set_precompiled(&precompiled_rom))
+        cerr << "Precompiled code is for another ROM; running it from the block cache" << endl;
+#endif
+    cpu.power();
+    Capture capture(video_path, audio_path, cpu.apu()->sample_rate());
+    cpu.ppu()->set_frame_callback(Capture::frame_callback, &capture);
+    cpu.ppu()->set_frame_target(Capture::frame_target, &capture);
+    cpu.apu()->set_sample_callback(Capture::sample_callback, &capture);
+    cpu.apu()->set_sample_target(Capture::sample_target, &capture);
+    while (cpu.ppu()->frame_count() < frames)
+        cpu.run_cycles(CYCLES_PER_FRAME);
+    //The capture goes first; nothing may call into it after that
+    cpu.ppu()->set_frame_callback(nullptr, nullptr);
+    cpu.ppu()->set_frame_target(nullptr, nullptr);
+    cpu.apu()->set_sample_callback(nullptr, nullptr);
+    cpu.apu()->set_sample_target(nullptr, nullptr);
+    if (capture.failed())
+        cerr << "Capture: write failed" << endl;
+}
+
+//Runs each rom headless from decoded code and reports how often each fused idiom ran
+void fusion_stats(const vector<string> &roms, uint64_t frames) {
+    array<uint64_t, FUSION_COUNT> total = {};
+    for (const string &rom: roms) {
+        Cpu6502 cpu{CpuMode::BLOCK_CACHED};
+        cpu.set_frame_rendering(false);
+        cpu.load_rom(rom);
+        cpu.power();
+        while (cpu.ppu()->frame_count() < frames)
+            cpu.run_cycles(CYCLES_PER_FRAME);
+        cout << rom << ":";
+        for (size_t id = 1; id < FUSION_COUNT; id++) {
+            cout << " " << cpu.fusion_counts()[id];
+            total[id] += cpu.fusion_counts()[id];
         }
+        cout << endl;
     }
+    for (size_t id = 1; id < FUSION_COUNT; id++)
+        cout << setw(20) << left << fusions[id].name << " " << total[id] << endl;
+}
 
+//Packs every .json file in json_dir into a .tv file of the same name in out_dir
+void convert_tests(const string &json_dir, const string &out_dir, bool with_cycles) {
+    namespace fs = std::filesystem;
+    fs::create_directories(out_dir);
+    for (const auto &entry: fs::directory_iterator(json_dir)) {
+        if (entry.path().extension() != ".json")
+            continue;
+        std::ifstream file(entry.path());
+        TestVectorWriter writer;
+        JsonTestReader reader(with_cycles, [](void *context, const TestCase &test) {
+            static_cast<TestVectorWriter *>(context)->add(test.view());
+        }, &writer);
+        size_t cases = reader.read(file);
+        fs::path out = fs::path(out_dir) / entry.path().stem();
+        writer.write(out.string() + ".tv");
+        cout << "Converted " << entry.path().filename().string() << " (" << cases << " cases)" << endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    //NESEmulator --record <rom> <frames> <video.y4m> <audio.wav>
+    if (argc == 6 && string(argv[1]) == "--record") {
+        record(argv[2], stoull(argv[3]), argv[4], argv[5]);
+        return 0;
+    }
+    //NESEmulator --fusion-stats <frames> <rom>...
+    if (argc >= 4 && string(argv[1]) == "--fusion-stats") {
+        fusion_stats(vector<string>(argv + 3, argv + argc), stoull(argv[2]));
+        return 0;
+    }
+    //NESEmulator --convert <json dir> <out dir> [--cycles]
+    if ((argc == 4 || argc == 5) && string(argv[1]) == "--convert") {
+        convert_tests(argv[2], argv[3], argc == 5 && string(argv[4]) == "--cycles");
+        return 0;
+    }
+
+    //NESEmulator [--jobs N] [--cached | --jit] [test dir]
+    unsigned threads = thread::hardware_concurrency();
+    string test_dir = "../tests/v1/";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc)
+            threads = stoul(argv[++i]);
+        else if (arg == "--cached")
+            harness_mode = CpuMode::BLOCK_CACHED;
+        else if (arg == "--jit")
+            harness_mode = CpuMode::JIT;
+        else
+            test_dir = arg;
+    }
+    return run_processor_tests(test_dir, threads) ? 0 : 1;
 }
@@ -0,0 +1,337 @@
+#include "mapper.h"
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+Mapper::Mapper(shared_ptr<const Cartridge> cartridge) : cart(std::move(cartridge)) {
+    prg_ram.resize(cart->prg_ram_size);
+    if (cart->chr_rom.empty()) {
+        chr_ram.resize(0x2000);
+        chr_data = chr_ram.data();
+        chr_size = chr_ram.size();
+    } else {
+        chr_data = cart->chr_rom.data();
+        chr_size = cart->chr_rom.size();
+    }
+    mirror = cart->mirroring;
+}
+
+void Mapper::attach(Memory &mem, const uint64_t &cpu_clock) {
+    memory = &mem;
+    clock = &cpu_clock;
+    if (!prg_ram.empty())
+        memory->map_ram(0x60, 0x20, prg_ram.data(), min<uint32_t>(prg_ram.size(), PRG_BANK_SIZE));
+    memory->map_mmio_write(0x80, 0x80, {nullptr, register_write, this});
+    reset();
+}
+
+const uint8_t *Mapper::chr_read(int slot) const {
+    return chr_read_banks[slot];
+}
+
+uint8_t *Mapper::chr_write(int slot) const {
+    return chr_write_banks[slot];
+}
+
+span<const uint8_t> Mapper::chr() const {
+    return {chr_data, chr_size};
+}
+
+uint32_t Mapper::chr_offset(int slot) const {
+    return chr_read_banks[slot] - chr_data;
+}
+
+Mirroring Mapper::mirroring() const {
+    return mirror;
+}
+
+void Mapper::clock_scanline() {
+}
+
+bool Mapper::irq_pending() const {
+    return irq;
+}
+
+void Mapper::connect_irq(InterruptLines &lines) {
+    irq_lines = &lines;
+    irq_lines->set_irq(IRQ_MAPPER, irq);
+}
+
+void Mapper::set_irq(bool active) {
+    irq = active;
+    if (irq_lines)
+        irq_lines->set_irq(IRQ_MAPPER, active);
+}
+
+const Cartridge &Mapper::cartridge() const {
+    return *cart;
+}
+
+//Byte offset of bank (counted in units of size) wrapped to the data actually present
+static uint32_t bank_offset(int bank, uint32_t size, uint32_t total) {
+    int count = max<int>(1, total / size);
+    bank %= count;
+    if (bank < 0)
+        bank += count;
+    return bank * size;
+}
+
+void Mapper::set_prg_8k(int slot, int bank) {
+    uint32_t offset = bank_offset(bank, PRG_BANK_SIZE, cart->prg_rom.size());
+    memory->map_read(0x80 + slot * 0x20, 0x20, cart->prg_rom.data() + offset, PRG_BANK_SIZE);
+}
+
+void Mapper::set_prg_16k(int slot, int bank) {
+    uint32_t offset = bank_offset(bank, 2 * PRG_BANK_SIZE, cart->prg_rom.size());
+    memory->map_read(0x80 + slot * 0x40, 0x40, cart->prg_rom.data() + offset,
+                     min<uint32_t>(2 * PRG_BANK_SIZE, cart->prg_rom.size()));
+}
+
+void Mapper::set_prg_32k(int bank) {
+    uint32_t offset = bank_offset(bank, 4 * PRG_BANK_SIZE, cart->prg_rom.size());
+    memory->map_read(0x80, 0x80, cart->prg_rom.data() + offset,
+                     min<uint32_t>(4 * PRG_BANK_SIZE, cart->prg_rom.size()));
+}
+
+void Mapper::set_chr_1k(int slot, int bank) {
+    uint32_t offset = bank_offset(bank, CHR_BANK_SIZE, chr_size);
+    chr_read_banks[slot] = chr_data + offset;
+    chr_write_banks[slot] = chr_ram.empty() ? nullptr : chr_ram.data() + offset;
+}
+
+void Mapper::set_chr_2k(int slot, int bank) {
+    uint32_t offset = bank_offset(bank, 2 * CHR_BANK_SIZE, chr_size);
+    for (int i = 0; i < 2; i++)
+        set_chr_1k(slot * 2 + i, (offset / CHR_BANK_SIZE) + i);
+}
+
+void Mapper::set_chr_4k(int slot, int bank) {
+    uint32_t offset = bank_offset(bank, 4 * CHR_BANK_SIZE, chr_size);
+    for (int i = 0; i < 4; i++)
+        set_chr_1k(slot * 4 + i, (offset / CHR_BANK_SIZE) + i);
+}
+
+void Mapper::set_chr_8k(int bank) {
+    uint32_t offset = bank_offset(bank, 8 * CHR_BANK_SIZE, chr_size);
+    for (int i = 0; i < 8; i++)
+        set_chr_1k(i, (offset / CHR_BANK_SIZE) + i);
+}
+
+void Mapper::set_mirroring(Mirroring mode) {
+    mirror = mode;
+}
+
+void Mapper::register_write(void *context, uint16_t address, uint8_t value) {
+    static_cast<Mapper *>(context)->write_register(address, value);
+}
+
+
+void NromMapper::reset() {
+    set_prg_16k(0, 0);
+    set_prg_16k(1, -1);
+    set_chr_8k(0);
+}
+
+void NromMapper::write_register(uint16_t address, uint8_t value) {
+}
+
+
+void Mmc1Mapper::reset() {
+    last_write = NO_WRITE;
+    shift = 0;
+    shift_count = 0;
+    control = 0x0C;
+    chr_bank_0 = 0;
+    chr_bank_1 = 0;
+    prg_bank = 0;
+    update_banks();
+}
+
+void Mmc1Mapper::write_register(uint16_t address, uint8_t value) {
+    //Outside the cycle-stepped engine both writes of a read-modify-write instruction carry
+    //the clock of its start, so the same cycle counts as the next one
+    if (*clock - last_write < 2)
+        return;
+    last_write = *clock;
+    if (value & 0x80) {
+        shift = 0;
+        shift_count = 0;
+        control |= 0x0C;
+        update_banks();
+        return;
+    }
+    //Registers are loaded serially, one bit per write, LSB first
+    shift |= (value & 1) << shift_count;
+    if (++shift_count < 5)
+        return;
+    switch ((address >> 13) & 3) {
+        case 0:
+            control = shift;
+            break;
+        case 1:
+            chr_bank_0 = shift;
+            break;
+        case 2:
+            chr_bank_1 = shift;
+            break;
+        case 3:
+            prg_bank = shift;
+            break;
+    }
+    shift = 0;
+    shift_count = 0;
+    update_banks();
+}
+
+void Mmc1Mapper::update_banks() {
+    static constexpr Mirroring mirror_modes[] = {Mirroring::SINGLE_SCREEN_LOW, Mirroring::SINGLE_SCREEN_HIGH,
+                                                 Mirroring::VERTICAL, Mirroring::HORIZONTAL};
+    set_mirroring(mirror_modes[control & 3]);
+
+    //512KB boards (SUROM) use bit 4 of the CHR register to pick the 256KB half of PRG
+    int outer = cart->prg_rom.size() > 0x40000 ? (chr_bank_0 & 0x10) : 0;
+    int bank = prg_bank & 0x0F;
+    switch ((control >> 2) & 3) {
+        case 0:
+        case 1:
+            set_prg_32k((outer | (bank & 0x0E)) >> 1);
+            break;
+        case 2:
+            set_prg_16k(0, outer);
+            set_prg_16k(1, outer | bank);
+            break;
+        case 3:
+            set_prg_16k(0, outer | bank);
+            set_prg_16k(1, outer | 0x0F);
+            break;
+    }
+
+    if (control & 0x10) {
+        set_chr_4k(0, chr_bank_0);
+        set_chr_4k(1, chr_bank_1);
+    } else {
+        set_chr_8k(chr_bank_0 >> 1);
+    }
+}
+
+
+void UxromMapper::reset() {
+    set_prg_16k(0, 0);
+    set_prg_16k(1, -1);
+    set_chr_8k(0);
+}
+
+void UxromMapper::write_register(uint16_t address, uint8_t value) {
+    //Bus conflict: the ROM drives the bus at the same time
+    value &= memory->read_byte(address);
+    set_prg_16k(0, value);
+}
+
+
+void CnromMapper::reset() {
+    set_prg_16k(0, 0);
+    set_prg_16k(1, -1);
+    set_chr_8k(0);
+}
+
+void CnromMapper::write_register(uint16_t address, uint8_t value) {
+    //Bus conflict: the ROM drives the bus at the same time
+    value &= memory->read_byte(address);
+    set_chr_8k(value);
+}
+
+
+void Mmc3Mapper::reset() {
+    bank_select = 0;
+    bank_registers = {0, 2, 4, 5, 6, 7, 0, 1};
+    irq_latch = 0;
+    irq_counter = 0;
+    irq_reload = false;
+    irq_enabled = false;
+    set_irq(false);
+    update_banks();
+}
+
+void Mmc3Mapper::write_register(uint16_t address, uint8_t value) {
+    switch (address & 0xE001) {
+        case 0x8000:
+            bank_select = value;
+            update_banks();
+            break;
+        case 0x8001:
+            bank_registers[bank_select & 7] = value;
+            update_banks();
+            break;
+        case 0xA000:
+            if (cart->mirroring != Mirroring::FOUR_SCREEN)
+                set_mirroring(value & 1 ? Mirroring::HORIZONTAL : Mirroring::VERTICAL);
+            break;
+        case 0xA001:
+            //PRG-RAM protect, not emulated
+            break;
+        case 0xC000:
+            irq_latch = value;
+            break;
+        case 0xC001:
+            irq_counter = 0;
+            irq_reload = true;
+            break;
+        case 0xE000:
+            irq_enabled = false;
+            set_irq(false);
+            break;
+        case 0xE001:
+            irq_enabled = true;
+            break;
+    }
+}
+
+void Mmc3Mapper::update_banks() {
+    if (bank_select & 0x40) {
+        set_prg_8k(0, -2);
+        set_prg_8k(2, bank_registers[6]);
+    } else {
+        set_prg_8k(0, bank_registers[6]);
+        set_prg_8k(2, -2);
+    }
+    set_prg_8k(1, bank_registers[7]);
+    set_prg_8k(3, -1);
+
+    //Bit 7 swaps the 2KB and 1KB halves of the pattern tables
+    int two_k = bank_select & 0x80 ? 2 : 0;
+    int one_k = bank_select & 0x80 ? 0 : 4;
+    set_chr_2k(two_k, bank_registers[0] >> 1);
+    set_chr_2k(two_k + 1, bank_registers[1] >> 1);
+    for (int i = 0; i < 4; i++)
+        set_chr_1k(one_k + i, bank_registers[2 + i]);
+}
+
+void Mmc3Mapper::clock_scanline() {
+    if (irq_counter == 0 || irq_reload) {
+        irq_counter = irq_latch;
+        irq_reload = false;
+    } else {
+        irq_counter--;
+    }
+    if (irq_counter == 0 && irq_enabled)
+        set_irq(true);
+}
+
+
+unique_ptr<Mapper> create_mapper(shared_ptr<const Cartridge> cartridge) {
+    switch (cartridge->mapper_number) {
+        case 0:
+            return make_unique<NromMapper>(std::move(cartridge));
+        case 1:
+            return make_unique<Mmc1Mapper>(std::move(cartridge));
+        case 2:
+            return make_unique<UxromMapper>(std::move(cartridge));
+        case 3:
+            return make_unique<CnromMapper>(std::move(cartridge));
+        case 4:
+            return make_unique<Mmc3Mapper>(std::move(cartridge));
+        default:
+            throw invalid_argument("Unsupported mapper " + to_string(cartridge->mapper_number));
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef NESEMULATOR_MAPPER_H
+#define NESEMULATOR_MAPPER_H
+
+#include <array>
+#include <memory>
+#include <vector>
+#include "state.h"
+#include "cartridge.h"
+
+constexpr uint32_t PRG_BANK_SIZE = 0x2000; // 8KB, the finest PRG granularity any supported board uses
+constexpr uint32_t CHR_BANK_SIZE = 0x0400; // 1KB, likewise for CHR
+constexpr int CHR_SLOTS = 8;               // $0000-$1FFF on the PPU bus in 1KB slots
+
+//Board logic. Banks are switched by repointing pages of the CPU bus and the CHR slots,
+//never by copying; every bank is an offset into the cartridge's PRG/CHR data.
+class Mapper {
+public:
+    explicit Mapper(std::shared_ptr<const Cartridge> cartridge);
+
+    virtual ~Mapper() = default;
+
+    Mapper(const Mapper &) = delete;
+
+    Mapper &operator=(const Mapper &) = delete;
+
+    //Takes over $6000-$FFFF of the CPU bus and applies the power-on banks. clock is read on
+    //register writes to timestamp them, as in Apu::attach.
+    void attach(Memory &memory, const uint64_t &clock);
+
+    virtual void reset() = 0;
+
+    //PPU side: 1KB CHR slots. chr_write is null for slots backed by CHR-ROM.
+    [[nodiscard]] const uint8_t *chr_read(int slot) const;
+
+    [[nodiscard]] uint8_t *chr_write(int slot) const;
+
+    //All CHR data (ROM, or the 8KB of CHR-RAM) and where each slot currently points into it
+    [[nodiscard]] std::span<const uint8_t> chr() const;
+
+    [[nodiscard]] uint32_t chr_offset(int slot) const;
+
+    [[nodiscard]] Mirroring mirroring() const;
+
+    //Called once per scanline on the PPU A12 rising edge (MMC3 IRQ counter)
+    virtual void clock_scanline();
+
+    [[nodiscard]] bool irq_pending() const;
+
+    //Drives the IRQ_MAPPER bit of the CPU's IRQ line from now on
+    void connect_irq(InterruptLines &lines);
+
+    [[nodiscard]] const Cartridge &cartridge() const;
+
+protected:
+    //CPU writes to $8000-$FFFF
+    virtual void write_register(uint16_t address, uint8_t value) = 0;
+
+    //slot counts windows of the bank size within $8000-$FFFF; a negative bank counts from the last one
+    void set_prg_8k(int slot, int bank);
+
+    void set_prg_16k(int slot, int bank);
+
+    void set_prg_32k(int bank);
+
+    //slot counts windows of the bank size within $0000-$1FFF on the PPU bus
+    void set_chr_1k(int slot, int bank);
+
+    void set_chr_2k(int slot, int bank);
+
+    void set_chr_4k(int slot, int bank);
+
+    void set_chr_8k(int bank);
+
+    void set_mirroring(Mirroring mode);
+
+    void set_irq(bool active);
+
+    std::shared_ptr<const Cartridge> cart;
+    Memory *memory = nullptr;
+    const uint64_t *clock = nullptr;
+
+private:
+    static void register_write(void *context, uint16_t address, uint8_t value);
+
+    std::vector<uint8_t> prg_ram;
+    std::vector<uint8_t> chr_ram;
+    const uint8_t *chr_data;
+    uint32_t chr_size;
+    std::array<const uint8_t *, CHR_SLOTS> chr_read_banks = {};
+    std::array<uint8_t *, CHR_SLOTS> chr_write_banks = {};
+    Mirroring mirror;
+    bool irq = false;
+    InterruptLines *irq_lines = nullptr;
+};
+
+//Mapper 0
+class NromMapper : public Mapper {
+public:
+    using Mapper::Mapper;
+
+    void reset() override;
+
+protected:
+    void write_register(uint16_t address, uint8_t value) override;
+};
+
+//Mapper 1
+class Mmc1Mapper : public Mapper {
+public:
+    using Mapper::Mapper;
+
+    void reset() override;
+
+protected:
+    void write_register(uint16_t address, uint8_t value) override;
+
+private:
+    void update_banks();
+
+    uint8_t shift = 0;
+    uint8_t shift_count = 0;
+    uint8_t control = 0x0C;
+    uint8_t chr_bank_0 = 0;
+    uint8_t chr_bank_1 = 0;
+    uint8_t prg_bank = 0;
+    //Clock of the last write the serial port took. It ignores one on the next cycle, which is
+    //how a read-modify-write instruction loads only its unmodified value.
+    uint64_t last_write = NO_WRITE;
+    //Two cycles short of wrapping, so no clock is within one cycle of it
+    static constexpr uint64_t NO_WRITE = ~uint64_t(0) - 1;
+};
+
+//Mapper 2
+class UxromMapper : public Mapper {
+public:
+    using Mapper::Mapper;
+
+    void reset() override;
+
+protected:
+    void write_register(uint16_t address, uint8_t value) override;
+};
+
+//Mapper 3
+class CnromMapper : public Mapper {
+public:
+    using Mapper::Mapper;
+
+    void reset() override;
+
+protected:
+    void write_register(uint16_t address, uint8_t value) override;
+};
+
+//Mapper 4
+class Mmc3Mapper : public Mapper {
+public:
+    using Mapper::Mapper;
+
+    void reset() override;
+
+    void clock_scanline() override;
+
+protected:
+    void write_register(uint16_t address, uint8_t value) override;
+
+private:
+    void update_banks();
+
+    uint8_t bank_select = 0;
+    std::array<uint8_t, 8> bank_registers = {};
+    uint8_t irq_latch = 0;
+    uint8_t irq_counter = 0;
+    bool irq_reload = false;
+    bool irq_enabled = false;
+};
+
+std::unique_ptr<Mapper> create_mapper(std::shared_ptr<const Cartridge> cartridge);
+
+#endif //NESEMULATOR_MAPPER_H
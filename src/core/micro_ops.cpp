@@ -0,0 +1,474 @@
+#include "micro_ops.h"
+#include "instructions.h"
+#include "operations.h"
+#include <array>
+
+using namespace std;
+
+//Bus pattern of an opcode. Everything without a pattern of its own is IMPLIED: a dummy read
+//of the next byte, then the instruction-stepped handler, which touches no memory for those.
+enum class MicroMode : uint8_t {
+    IMPLIED,
+    IMMEDIATE,
+    ZERO_PAGE,
+    ZERO_PAGE_X,
+    ZERO_PAGE_Y,
+    ABSOLUTE,
+    ABSOLUTE_X,
+    ABSOLUTE_Y,
+    INDIRECT_X,
+    INDIRECT_Y,
+    RELATIVE,
+    PUSH,
+    PULL,
+    JSR,
+    RTS,
+    RTI,
+    BRK,
+    JMP_ABSOLUTE,
+    JMP_INDIRECT
+};
+
+struct MicroOp {
+    MicroMode mode = MicroMode::IMPLIED;
+    OpKind kind = OpKind::READ;
+    void (*read)(Cpu6502_State &, Val) = nullptr;
+    Val (*write)(Cpu6502_State &) = nullptr;
+    Val (*modify)(Cpu6502_State &, Val) = nullptr;
+    //Branch condition for RELATIVE
+    FlagPositions flag = FlagPositions::CARRY;
+    bool flag_value = false;
+};
+
+template<class Operation>
+constexpr MicroOp micro(MicroMode mode) {
+    MicroOp op;
+    op.mode = mode;
+    op.kind = Operation::kind;
+    if constexpr (Operation::kind == OpKind::READ)
+        op.read = Operation::exec;
+    else if constexpr (Operation::kind == OpKind::WRITE)
+        op.write = Operation::value;
+    else
+        op.modify = Operation::exec;
+    return op;
+}
+
+constexpr MicroOp special(MicroMode mode) {
+    MicroOp op;
+    op.mode = mode;
+    return op;
+}
+
+constexpr MicroOp branch(FlagPositions flag, bool value) {
+    MicroOp op;
+    op.mode = MicroMode::RELATIVE;
+    op.flag = flag;
+    op.flag_value = value;
+    return op;
+}
+
+template<int base_addr, class Operation>
+constexpr void create_acc_suite(array<MicroOp, 256> &res) {
+    if constexpr (Operation::kind != OpKind::WRITE)
+        res[base_addr + 0x09] = micro<Operation>(MicroMode::IMMEDIATE);
+    res[base_addr + 0x0D] = micro<Operation>(MicroMode::ABSOLUTE);
+    res[base_addr + 0x1D] = micro<Operation>(MicroMode::ABSOLUTE_X);
+    res[base_addr + 0x19] = micro<Operation>(MicroMode::ABSOLUTE_Y);
+    res[base_addr + 0x05] = micro<Operation>(MicroMode::ZERO_PAGE);
+    res[base_addr + 0x15] = micro<Operation>(MicroMode::ZERO_PAGE_X);
+    res[base_addr + 0x01] = micro<Operation>(MicroMode::INDIRECT_X);
+    res[base_addr + 0x11] = micro<Operation>(MicroMode::INDIRECT_Y);
+}
+
+//The accumulator forms stay IMPLIED
+template<int base_addr, class Operation>
+constexpr void create_shift_suite(array<MicroOp, 256> &res) {
+    res[base_addr + 0x0E] = micro<Operation>(MicroMode::ABSOLUTE);
+    res[base_addr + 0x1E] = micro<Operation>(MicroMode::ABSOLUTE_X);
+    res[base_addr + 0x06] = micro<Operation>(MicroMode::ZERO_PAGE);
+    res[base_addr + 0x16] = micro<Operation>(MicroMode::ZERO_PAGE_X);
+}
+
+constexpr array<MicroOp, 256> micro_op_ref() {
+    array<MicroOp, 256> res{};
+
+    create_acc_suite<0x00, ORA>(res);
+    create_acc_suite<0x20, AND>(res);
+    create_acc_suite<0x40, EOR>(res);
+    create_acc_suite<0x60, ADC>(res);
+    create_acc_suite<0x80, STA>(res);
+    create_acc_suite<0xA0, LDA>(res);
+    create_acc_suite<0xC0, CMP>(res);
+    create_acc_suite<0xE0, SBC>(res);
+
+    create_shift_suite<0x00, ASL>(res);
+    create_shift_suite<0x40, LSR>(res);
+    create_shift_suite<0x20, ROL>(res);
+    create_shift_suite<0x60, ROR>(res);
+    create_shift_suite<0xC0, DEC>(res);
+    create_shift_suite<0xE0, INC>(res);
+
+    res[0xA2] = micro<LDX>(MicroMode::IMMEDIATE);
+    res[0xAE] = micro<LDX>(MicroMode::ABSOLUTE);
+    res[0xBE] = micro<LDX>(MicroMode::ABSOLUTE_Y);
+    res[0xA6] = micro<LDX>(MicroMode::ZERO_PAGE);
+    res[0xB6] = micro<LDX>(MicroMode::ZERO_PAGE_Y);
+
+    res[0xA0] = micro<LDY>(MicroMode::IMMEDIATE);
+    res[0xAC] = micro<LDY>(MicroMode::ABSOLUTE);
+    res[0xBC] = micro<LDY>(MicroMode::ABSOLUTE_X);
+    res[0xA4] = micro<LDY>(MicroMode::ZERO_PAGE);
+    res[0xB4] = micro<LDY>(MicroMode::ZERO_PAGE_X);
+
+    res[0x8E] = micro<STX>(MicroMode::ABSOLUTE);
+    res[0x86] = micro<STX>(MicroMode::ZERO_PAGE);
+    res[0x96] = micro<STX>(MicroMode::ZERO_PAGE_Y);
+
+    res[0x8C] = micro<STY>(MicroMode::ABSOLUTE);
+    res[0x84] = micro<STY>(MicroMode::ZERO_PAGE);
+    res[0x94] = micro<STY>(MicroMode::ZERO_PAGE_X);
+
+    res[0x2C] = micro<BIT>(MicroMode::ABSOLUTE);
+    res[0x24] = micro<BIT>(MicroMode::ZERO_PAGE);
+
+    res[0xE0] = micro<CPX>(MicroMode::IMMEDIATE);
+    res[0xEC] = micro<CPX>(MicroMode::ABSOLUTE);
+    res[0xE4] = micro<CPX>(MicroMode::ZERO_PAGE);
+
+    res[0xC0] = micro<CPY>(MicroMode::IMMEDIATE);
+    res[0xCC] = micro<CPY>(MicroMode::ABSOLUTE);
+    res[0xC4] = micro<CPY>(MicroMode::ZERO_PAGE);
+
+    res[0x48] = special(MicroMode::PUSH);
+    res[0x08] = special(MicroMode::PUSH);
+    res[0x68] = special(MicroMode::PULL);
+    res[0x28] = special(MicroMode::PULL);
+
+    res[0x4C] = special(MicroMode::JMP_ABSOLUTE);
+    res[0x6C] = special(MicroMode::JMP_INDIRECT);
+    res[0x20] = special(MicroMode::JSR);
+    res[0x60] = special(MicroMode::RTS);
+    res[0x40] = special(MicroMode::RTI);
+    res[0x00] = special(MicroMode::BRK);
+
+    res[0x90] = branch(FlagPositions::CARRY, false);
+    res[0xB0] = branch(FlagPositions::CARRY, true);
+    res[0xF0] = branch(FlagPositions::ZERO, true);
+    res[0x30] = branch(FlagPositions::NEG, true);
+    res[0xD0] = branch(FlagPositions::ZERO, false);
+    res[0x10] = branch(FlagPositions::NEG, false);
+    res[0x50] = branch(FlagPositions::OVF, false);
+    res[0x70] = branch(FlagPositions::OVF, true);
+    return res;
+}
+
+constexpr array<MicroOp, 256> micro_ops = micro_op_ref();
+
+static uint8_t read(Cpu6502_State &cs, uint16_t address) {
+    return cs.get_byte(Addr(address)).val;
+}
+
+static uint8_t fetch(Cpu6502_State &cs) {
+    return cs.get_instr_byte().val;
+}
+
+static uint16_t stack_addr(Cpu6502_State &cs) {
+    return 0x0100 | cs.reg().getS().val;
+}
+
+void MicroOpCpu::step(Cpu6502_State &cs) {
+    if (t == 0) {
+        //A taken interrupt runs the BRK sequence in place of the fetched opcode
+        InterruptLines &lines = cs.interrupts();
+        hardware_interrupt = false;
+        vector = IRQ_VECTOR;
+        if (lines.nmi) {
+            lines.nmi = false;
+            hardware_interrupt = true;
+            vector = NMI_VECTOR;
+        } else if (lines.irq && !cs.reg().get_flag(FlagPositions::INTERRUPT_DISABLE)) {
+            hardware_interrupt = true;
+        }
+        if (hardware_interrupt) {
+            read(cs, cs.reg().getPC().addr);
+            opcode = 0x00;
+        } else {
+            opcode = fetch(cs);
+        }
+        access_start = 0;
+        t = 1;
+        return;
+    }
+    t = execute(cs) ? 0 : t + 1;
+}
+
+bool MicroOpCpu::execute(Cpu6502_State &cs) {
+    const MicroOp &op = micro_ops[opcode];
+    Reg &r = cs.reg();
+    if (access_start && t >= access_start)
+        return access(cs, t - access_start);
+
+    //Indexed modes read the effective address before the high byte is fixed up. Reads that
+    //didn't cross a page are done at that point; everything else gets an extra cycle.
+    auto indexed_fixup = [&]() {
+        if (op.kind == OpKind::READ && !page_crossed) {
+            access_start = t;
+            return access(cs, 0);
+        }
+        read(cs, page_crossed ? addr - 0x100 : addr);
+        access_start = t + 1;
+        return false;
+    };
+
+    switch (op.mode) {
+        case MicroMode::IMPLIED:
+            read(cs, r.getPC().addr);
+            instructions[opcode](cs);
+            return true;
+        case MicroMode::IMMEDIATE:
+            op.read(cs, cs.get_instr_byte());
+            return true;
+        case MicroMode::ZERO_PAGE:
+            addr = fetch(cs);
+            access_start = 2;
+            return false;
+        case MicroMode::ZERO_PAGE_X:
+        case MicroMode::ZERO_PAGE_Y:
+            if (t == 1) {
+                addr = fetch(cs);
+                return false;
+            }
+            read(cs, addr);
+            addr = (addr + (op.mode == MicroMode::ZERO_PAGE_X ? r.getX() : r.getY()).val) & 0xFF;
+            access_start = 3;
+            return false;
+        case MicroMode::ABSOLUTE:
+            if (t == 1) {
+                addr = fetch(cs);
+                return false;
+            }
+            addr |= fetch(cs) << 8;
+            access_start = 3;
+            return false;
+        case MicroMode::ABSOLUTE_X:
+        case MicroMode::ABSOLUTE_Y:
+            if (t == 1) {
+                addr = fetch(cs);
+                return false;
+            }
+            if (t == 2) {
+                uint16_t base = addr | (fetch(cs) << 8);
+                addr = base + (op.mode == MicroMode::ABSOLUTE_X ? r.getX() : r.getY()).val;
+                page_crossed = (base ^ addr) & 0xFF00;
+                return false;
+            }
+            return indexed_fixup();
+        case MicroMode::INDIRECT_X:
+            switch (t) {
+                case 1:
+                    pointer = fetch(cs);
+                    return false;
+                case 2:
+                    read(cs, pointer);
+                    pointer += r.getX().val;
+                    return false;
+                case 3:
+                    addr = read(cs, pointer);
+                    return false;
+                default:
+                    addr |= read(cs, static_cast<uint8_t>(pointer + 1)) << 8;
+                    access_start = 5;
+                    return false;
+            }
+        case MicroMode::INDIRECT_Y:
+            switch (t) {
+                case 1:
+                    pointer = fetch(cs);
+                    return false;
+                case 2:
+                    addr = read(cs, pointer);
+                    return false;
+                case 3: {
+                    uint16_t base = addr | (read(cs, static_cast<uint8_t>(pointer + 1)) << 8);
+                    addr = base + r.getY().val;
+                    page_crossed = (base ^ addr) & 0xFF00;
+                    return false;
+                }
+                default:
+                    return indexed_fixup();
+            }
+        case MicroMode::RELATIVE:
+            switch (t) {
+                case 1:
+                    data = fetch(cs);
+                    return r.get_flag(op.flag) != op.flag_value;
+                case 2: {
+                    uint16_t pc = r.getPC().addr;
+                    read(cs, pc);
+                    addr = pc + static_cast<int8_t>(data);
+                    if (((addr ^ pc) & 0xFF00) == 0) {
+                        r.setPC(Addr(addr));
+                        return true;
+                    }
+                    //PCL is updated first; the next cycle reads from the unfixed PC
+                    r.setPC(Addr((pc & 0xFF00) | (addr & 0xFF)));
+                    return false;
+                }
+                default:
+                    read(cs, r.getPC().addr);
+                    r.setPC(Addr(addr));
+                    return true;
+            }
+        case MicroMode::PUSH:
+            if (t == 1) {
+                read(cs, r.getPC().addr);
+                return false;
+            }
+            instructions[opcode](cs);
+            return true;
+        case MicroMode::PULL:
+            if (t == 1) {
+                read(cs, r.getPC().addr);
+                return false;
+            }
+            if (t == 2) {
+                read(cs, stack_addr(cs));
+                return false;
+            }
+            instructions[opcode](cs);
+            return true;
+        case MicroMode::JSR:
+            switch (t) {
+                case 1:
+                    data = fetch(cs);
+                    return false;
+                case 2:
+                    read(cs, stack_addr(cs));
+                    return false;
+                case 3:
+                    cs.push_stack(Val(r.getPC().addr >> 8));
+                    return false;
+                case 4:
+                    cs.push_stack(Val(r.getPC().addr & 0xFF));
+                    return false;
+                default:
+                    r.setPC(Addr((read(cs, r.getPC().addr) << 8) | data));
+                    return true;
+            }
+        case MicroMode::RTS:
+            switch (t) {
+                case 1:
+                    read(cs, r.getPC().addr);
+                    return false;
+                case 2:
+                    read(cs, stack_addr(cs));
+                    return false;
+                case 3:
+                    data = cs.pull_stack().val;
+                    return false;
+                case 4:
+                    r.setPC(Addr((cs.pull_stack().val << 8) | data));
+                    return false;
+                default:
+                    read(cs, r.getPC().addr);
+                    r.incrPC();
+                    return true;
+            }
+        case MicroMode::RTI:
+            switch (t) {
+                case 1:
+                    read(cs, r.getPC().addr);
+                    return false;
+                case 2:
+                    read(cs, stack_addr(cs));
+                    return false;
+                case 3:
+                    r.setP(cs.pull_stack());
+                    r.set_flag(FlagPositions::UNUSED, true);
+                    r.set_flag(FlagPositions::B, false);
+                    return false;
+                case 4:
+                    data = cs.pull_stack().val;
+                    return false;
+                default:
+                    r.setPC(Addr((cs.pull_stack().val << 8) | data));
+                    return true;
+            }
+        case MicroMode::BRK:
+            switch (t) {
+                case 1:
+                    read(cs, r.getPC().addr);
+                    if (!hardware_interrupt)
+                        r.incrPC();
+                    return false;
+                case 2:
+                    cs.push_stack(Val(r.getPC().addr >> 8));
+                    return false;
+                case 3:
+                    cs.push_stack(Val(r.getPC().addr & 0xFF));
+                    return false;
+                case 4:
+                    cs.push_stack(Val(hardware_interrupt ? r.getP().val : r.getP().val | 0x10));
+                    return false;
+                case 5:
+                    data = read(cs, vector);
+                    r.set_flag(FlagPositions::B, false);
+                    r.set_flag(FlagPositions::INTERRUPT_DISABLE, true);
+                    return false;
+                default:
+                    r.setPC(Addr((read(cs, vector + 1) << 8) | data));
+                    return true;
+            }
+        case MicroMode::JMP_ABSOLUTE:
+            if (t == 1) {
+                data = fetch(cs);
+                return false;
+            }
+            r.setPC(Addr((read(cs, r.getPC().addr) << 8) | data));
+            return true;
+        case MicroMode::JMP_INDIRECT:
+            switch (t) {
+                case 1:
+                    addr = fetch(cs);
+                    return false;
+                case 2:
+                    addr |= fetch(cs) << 8;
+                    return false;
+                case 3:
+                    data = read(cs, addr);
+                    return false;
+                default:
+                    //The pointer's high byte comes from the same page (6502 bug)
+                    r.setPC(Addr((read(cs, (addr & 0xFF00) | ((addr + 1) & 0xFF)) << 8) | data));
+                    return true;
+            }
+    }
+    return true;
+}
+
+bool MicroOpCpu::access(Cpu6502_State &cs, int k) {
+    const MicroOp &op = micro_ops[opcode];
+    switch (op.kind) {
+        case OpKind::READ:
+            op.read(cs, cs.get_byte(Addr(addr)));
+            return true;
+        case OpKind::WRITE:
+            cs.set_byte(Addr(addr), op.write(cs));
+            return true;
+        case OpKind::READ_MODIFY_WRITE:
+            if (k == 0) {
+                data = read(cs, addr);
+                return false;
+            }
+            if (k == 1) {
+                //The unmodified value is written back while the ALU works
+                cs.set_byte(Addr(addr), Val(data));
+                data = op.modify(cs, Val(data)).val;
+                return false;
+            }
+            cs.set_byte(Addr(addr), Val(data));
+            return true;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef NESEMULATOR_MICRO_OPS_H
+#define NESEMULATOR_MICRO_OPS_H
+
+#include <cstdint>
+#include "state.h"
+
+//Cycle-stepped execution: every call to step() is one CPU cycle and performs exactly the
+//bus access the 6502 makes on that cycle, including the dummy reads and writes of indexed,
+//read-modify-write, stack and branch instructions. Slower than the instruction-stepped
+//table in instructions.cpp, which stays untouched; use it when peripherals need to see
+//accesses on their true cycle. Interrupt lines are sampled at each instruction boundary.
+class MicroOpCpu {
+public:
+    void step(Cpu6502_State &cs);
+
+    //True when the next step() fetches an opcode
+    [[nodiscard]] bool at_instruction_boundary() const {
+        return t == 0;
+    }
+
+    //Drops any instruction in flight
+    void reset() {
+        t = 0;
+    }
+
+private:
+    //Cycle t of the addressing/stack sequence; returns true when the instruction is done
+    bool execute(Cpu6502_State &cs);
+
+    //Cycle k after the effective address is known
+    bool access(Cpu6502_State &cs, int k);
+
+    uint8_t opcode = 0;
+    uint8_t t = 0;
+    uint8_t access_start = 0;
+    uint8_t data = 0;
+    uint8_t pointer = 0;
+    uint16_t addr = 0;
+    bool page_crossed = false;
+    //Set when the BRK sequence is running for NMI/IRQ rather than the opcode
+    bool hardware_interrupt = false;
+    uint16_t vector = 0;
+};
+
+#endif //NESEMULATOR_MICRO_OPS_H
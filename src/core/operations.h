@@ -0,0 +1,237 @@
+#ifndef NESEMULATOR_OPERATIONS_H
+#define NESEMULATOR_OPERATIONS_H
+
+#include "state.h"
+
+//What an instruction does to its operand, independent of how the operand is addressed.
+//Shared by the instruction-stepped and the cycle-stepped engines.
+
+//READ operations consume a value, WRITE operations produce one,
+//READ_MODIFY_WRITE operations transform one in place
+enum class OpKind {
+    READ,
+    WRITE,
+    READ_MODIFY_WRITE
+};
+
+struct ADC {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        cs.reg().setA(cs.add(val, cs.reg().getA()));
+    }
+};
+
+struct AND {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        Val res = val & cs.reg().getA();
+        cs.reg().set_nz(res);
+        cs.reg().setA(res);
+    }
+};
+
+struct LDA {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        cs.reg().set_nz(val);
+        cs.reg().setA(val);
+    }
+};
+
+struct EOR {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        Val res = val ^ cs.reg().getA();
+        cs.reg().set_nz(res);
+        cs.reg().setA(res);
+    }
+};
+
+struct ORA {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        Val res = val | cs.reg().getA();
+        cs.reg().set_nz(res);
+        cs.reg().setA(res);
+    }
+};
+
+struct CMP {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        Val res = cs.reg().getA() - val;
+        //A - val without borrow <=> A + ~val + 1 carries out of bit 7
+        cs.reg().set_carry_from(cs.reg().getA().val + (~val).val + 1);
+        cs.reg().set_nz(res);
+    }
+};
+
+struct SBC {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        Val A = cs.reg().getA();
+        Val borrow = cs.reg().get_flag(FlagPositions::CARRY) ? Val(0) : Val(1);
+        Val result = A - val - borrow;
+        uint16_t temp_result = A.val + (~val).val + (1 - borrow.val);
+
+        cs.reg().set_carry_from(temp_result);
+        cs.reg().set_nz(result);
+        cs.reg().set_ovf_from(((A ^ result) & (A ^ val)).val);
+
+        cs.reg().setA(result);
+    }
+};
+
+struct LDX {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        cs.reg().setX(val);
+        cs.reg().set_nz(val);
+    }
+};
+
+struct LDY {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val val) {
+        cs.reg().setY(val);
+        cs.reg().set_nz(val);
+    }
+};
+
+struct BIT {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val memory_value) {
+        Val accumulator = cs.reg().getA();
+        Val result = accumulator & memory_value;
+        cs.reg().set_nz(memory_value, result);
+        cs.reg().set_ovf_from(memory_value.val << 1);
+    }
+};
+
+struct CPX {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val other) {
+        Val result = cs.reg().getX() - other;
+        cs.reg().set_carry_from(cs.reg().getX().val + (~other).val + 1);
+        cs.reg().set_nz(result);
+    }
+};
+
+struct CPY {
+    static constexpr OpKind kind = OpKind::READ;
+
+    static void exec(Cpu6502_State &cs, Val other) {
+        Val result = cs.reg().getY() - other;
+        cs.reg().set_carry_from(cs.reg().getY().val + (~other).val + 1);
+        cs.reg().set_nz(result);
+    }
+};
+
+struct STA {
+    static constexpr OpKind kind = OpKind::WRITE;
+
+    static Val value(Cpu6502_State &cs) {
+        return cs.reg().getA();
+    }
+};
+
+struct STX {
+    static constexpr OpKind kind = OpKind::WRITE;
+
+    static Val value(Cpu6502_State &cs) {
+        return cs.reg().getX();
+    }
+};
+
+struct STY {
+    static constexpr OpKind kind = OpKind::WRITE;
+
+    static Val value(Cpu6502_State &cs) {
+        return cs.reg().getY();
+    }
+};
+
+struct ASL {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        cs.reg().set_carry_from(current.val << 1);
+        Val result = current << 1;
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+struct LSR {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        Val result = current >> 1;
+        cs.reg().set_carry_from(current.val << 8);
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+struct ROL {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        bool carry_in = cs.reg().get_flag(FlagPositions::CARRY);
+        uint16_t shifted = (current.val << 1) | (carry_in ? 1 : 0);
+
+        Val result = Val(static_cast<uint8_t>(shifted));
+
+        cs.reg().set_carry_from(shifted);
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+struct ROR {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        bool carry_in = cs.reg().get_flag(FlagPositions::CARRY);
+
+        Val result = Val((current.val >> 1) | (carry_in ? 0x80 : 0));
+
+        //bit 0 moves into carry; N ends up equal to carry_in, which is bit 7 of result
+        cs.reg().set_carry_from(current.val << 8);
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+struct DEC {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        Val result = current - Val(1);
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+struct INC {
+    static constexpr OpKind kind = OpKind::READ_MODIFY_WRITE;
+
+    static Val exec(Cpu6502_State &cs, Val current) {
+        Val result = current + Val(1);
+        cs.reg().set_nz(result);
+        return result;
+    }
+};
+
+#endif //NESEMULATOR_OPERATIONS_H
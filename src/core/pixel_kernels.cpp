@@ -0,0 +1,258 @@
+#include "pixel_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NESEMULATOR_HAS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+//Bit 7 of a CHR byte is the leftmost pixel
+static void decode_row(uint8_t low, uint8_t high, uint8_t *out) {
+    for (int px = 0; px < 8; px++) {
+        int bit = 7 - px;
+        out[px] = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+    }
+}
+
+static void decode_tiles_scalar(const uint8_t *chr, uint8_t *out, size_t tiles) {
+    for (size_t tile = 0; tile < tiles; tile++, chr += 16, out += 64)
+        for (int row = 0; row < 8; row++)
+            decode_row(chr[row], chr[row + 8], out + row * 8);
+}
+
+static int mix_line_scalar(const uint8_t *background, const uint8_t *sprites, uint8_t *out, int bg_left,
+                           int sprite_left) {
+    int hit = -1;
+    for (int x = 0; x < 256; x++) {
+        uint8_t b = x >= bg_left ? background[x] : 0;
+        uint8_t s = x >= sprite_left ? sprites[x] : 0;
+        uint8_t color = b;
+        if (s & 3) {
+            if ((s & SPRITE_ZERO) && (b & 3) && x != 255 && hit < 0)
+                hit = x;
+            if (!(b & 3) || !(s & SPRITE_BEHIND))
+                color = 0x10 | (s & 0x0F);
+        }
+        out[x] = color;
+    }
+    return hit;
+}
+
+static void lookup_palette_scalar(const uint8_t *colors, const uint8_t *palette, uint8_t mask, uint8_t *out,
+                                  size_t count) {
+    for (size_t i = 0; i < count; i++)
+        out[i] = palette[colors[i]] & mask;
+}
+
+static void expand_rgba_scalar(const uint8_t *indices, const uint32_t *table, uint32_t *out, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        out[i] = table[indices[i]];
+}
+
+static constexpr PixelKernels SCALAR_KERNELS = {
+        "scalar",
+        decode_tiles_scalar,
+        mix_line_scalar,
+        lookup_palette_scalar,
+        expand_rgba_scalar
+};
+
+#ifdef NESEMULATOR_HAS_X86_KERNELS
+
+//Expands the 8 bytes of one bitplane (rows 0-7) into 0/1 per pixel, two rows per vector
+__attribute__((target("sse2")))
+static void split_plane_sse2(const uint8_t *plane, __m128i rows[4]) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(plane));
+    __m128i x2 = _mm_unpacklo_epi8(bytes, bytes);
+    __m128i x4_low = _mm_unpacklo_epi16(x2, x2);
+    __m128i x4_high = _mm_unpackhi_epi16(x2, x2);
+    __m128i pairs[4] = {
+            _mm_unpacklo_epi32(x4_low, x4_low),
+            _mm_unpackhi_epi32(x4_low, x4_low),
+            _mm_unpacklo_epi32(x4_high, x4_high),
+            _mm_unpackhi_epi32(x4_high, x4_high)
+    };
+    for (int i = 0; i < 4; i++)
+        rows[i] = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(pairs[i], bits), bits), one);
+}
+
+__attribute__((target("sse2")))
+static void decode_tiles_sse2(const uint8_t *chr, uint8_t *out, size_t tiles) {
+    for (size_t tile = 0; tile < tiles; tile++, chr += 16, out += 64) {
+        __m128i low[4], high[4];
+        split_plane_sse2(chr, low);
+        split_plane_sse2(chr + 8, high);
+        for (int i = 0; i < 4; i++) {
+            __m128i pixels = _mm_or_si128(low[i], _mm_add_epi8(high[i], high[i]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16), pixels);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static int mix_line_sse2(const uint8_t *background, const uint8_t *sprites, uint8_t *out, int bg_left,
+                         int sprite_left) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque_bits = _mm_set1_epi8(3);
+    const __m128i behind = _mm_set1_epi8(SPRITE_BEHIND);
+    const __m128i sprite_zero = _mm_set1_epi8(SPRITE_ZERO);
+    const __m128i color_bits = _mm_set1_epi8(0x0F);
+    const __m128i sprite_palettes = _mm_set1_epi8(0x10);
+    //Lanes 0-7 of the first vector are the left column
+    const __m128i left_column = _mm_set_epi64x(-1, 0);
+    int hit = -1;
+    for (int x = 0; x < 256; x += 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(background + x));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sprites + x));
+        if (x == 0) {
+            if (bg_left)
+                b = _mm_and_si128(b, left_column);
+            if (sprite_left)
+                s = _mm_and_si128(s, left_column);
+        }
+        __m128i b_clear = _mm_cmpeq_epi8(_mm_and_si128(b, opaque_bits), zero);
+        __m128i s_clear = _mm_cmpeq_epi8(_mm_and_si128(s, opaque_bits), zero);
+        __m128i in_front = _mm_cmpeq_epi8(_mm_and_si128(s, behind), zero);
+        __m128i sprite_wins = _mm_andnot_si128(s_clear, _mm_or_si128(b_clear, in_front));
+        __m128i sprite_color = _mm_or_si128(_mm_and_si128(s, color_bits), sprite_palettes);
+        __m128i color = _mm_or_si128(_mm_and_si128(sprite_wins, sprite_color), _mm_andnot_si128(sprite_wins, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), color);
+
+        __m128i is_zero = _mm_cmpeq_epi8(_mm_and_si128(s, sprite_zero), sprite_zero);
+        __m128i overlap = _mm_andnot_si128(_mm_or_si128(b_clear, s_clear), is_zero);
+        int lanes = _mm_movemask_epi8(overlap) & (x == 240 ? 0x7FFF : 0xFFFF);
+        if (lanes && hit < 0)
+            hit = x + __builtin_ctz(lanes);
+    }
+    return hit;
+}
+
+__attribute__((target("avx2")))
+static int mix_line_avx2(const uint8_t *background, const uint8_t *sprites, uint8_t *out, int bg_left,
+                         int sprite_left) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i opaque_bits = _mm256_set1_epi8(3);
+    const __m256i behind = _mm256_set1_epi8(SPRITE_BEHIND);
+    const __m256i sprite_zero = _mm256_set1_epi8(SPRITE_ZERO);
+    const __m256i color_bits = _mm256_set1_epi8(0x0F);
+    const __m256i sprite_palettes = _mm256_set1_epi8(0x10);
+    const __m256i left_column = _mm256_set_epi64x(-1, -1, -1, 0);
+    int hit = -1;
+    for (int x = 0; x < 256; x += 32) {
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(background + x));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sprites + x));
+        if (x == 0) {
+            if (bg_left)
+                b = _mm256_and_si256(b, left_column);
+            if (sprite_left)
+                s = _mm256_and_si256(s, left_column);
+        }
+        __m256i b_clear = _mm256_cmpeq_epi8(_mm256_and_si256(b, opaque_bits), zero);
+        __m256i s_clear = _mm256_cmpeq_epi8(_mm256_and_si256(s, opaque_bits), zero);
+        __m256i in_front = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind), zero);
+        __m256i sprite_wins = _mm256_andnot_si256(s_clear, _mm256_or_si256(b_clear, in_front));
+        __m256i sprite_color = _mm256_or_si256(_mm256_and_si256(s, color_bits), sprite_palettes);
+        __m256i color = _mm256_blendv_epi8(b, sprite_color, sprite_wins);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), color);
+
+        __m256i is_zero = _mm256_cmpeq_epi8(_mm256_and_si256(s, sprite_zero), sprite_zero);
+        __m256i overlap = _mm256_andnot_si256(_mm256_or_si256(b_clear, s_clear), is_zero);
+        uint32_t lanes = static_cast<uint32_t>(_mm256_movemask_epi8(overlap)) & (x == 224 ? 0x7FFFFFFFu : 0xFFFFFFFFu);
+        if (lanes && hit < 0)
+            hit = x + __builtin_ctz(lanes);
+    }
+    return hit;
+}
+
+//Two 16-entry byte shuffles cover the 32 palette RAM entries
+__attribute__((target("avx2")))
+static void lookup_palette_avx2(const uint8_t *colors, const uint8_t *palette, uint8_t mask, uint8_t *out,
+                                size_t count) {
+    const __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(palette)));
+    const __m256i high_table = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette + 16)));
+    const __m256i index_bits = _mm256_set1_epi8(0x0F);
+    const __m256i high_bit = _mm256_set1_epi8(0x10);
+    const __m256i result_mask = _mm256_set1_epi8(static_cast<char>(mask));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(colors + i));
+        __m256i index = _mm256_and_si256(c, index_bits);
+        __m256i from_low = _mm256_shuffle_epi8(low_table, index);
+        __m256i from_high = _mm256_shuffle_epi8(high_table, index);
+        __m256i use_high = _mm256_cmpeq_epi8(_mm256_and_si256(c, high_bit), high_bit);
+        __m256i result = _mm256_and_si256(_mm256_blendv_epi8(from_low, from_high, use_high), result_mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), result);
+    }
+    lookup_palette_scalar(colors + i, palette, mask, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void expand_rgba_avx2(const uint8_t *indices, const uint32_t *table, uint32_t *out, size_t count) {
+    const int *base = reinterpret_cast<const int *>(table);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(indices + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_i32gather_epi32(base, index, 4));
+    }
+    expand_rgba_scalar(indices + i, table, out + i, count - i);
+}
+
+//SSE2 has no byte shuffle or gather, so the two lookups stay scalar there
+static constexpr PixelKernels SSE2_KERNELS = {
+        "sse2",
+        decode_tiles_sse2,
+        mix_line_sse2,
+        lookup_palette_scalar,
+        expand_rgba_scalar
+};
+
+//Tile decoding runs once per CHR-ROM at load, so the SSE2 version is kept there
+static constexpr PixelKernels AVX2_KERNELS = {
+        "avx2",
+        decode_tiles_sse2,
+        mix_line_avx2,
+        lookup_palette_avx2,
+        expand_rgba_avx2
+};
+
+#endif
+
+vector<const PixelKernels *> available_pixel_kernels() {
+    vector<const PixelKernels *> kernels = {&SCALAR_KERNELS};
+#ifdef NESEMULATOR_HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(&SSE2_KERNELS);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&AVX2_KERNELS);
+#endif
+    return kernels;
+}
+
+const PixelKernels &pixel_kernels() {
+    static const PixelKernels &best = *available_pixel_kernels().back();
+    return best;
+}
+
+constexpr array<uint32_t, 64> NES_PALETTE_RGBA = [] {
+    constexpr array<uint32_t, 64> rgb = {
+            0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+            0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+            0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+            0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+            0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+            0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+            0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+            0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000
+    };
+    array<uint32_t, 64> rgba = {};
+    for (size_t i = 0; i < rgb.size(); i++) {
+        uint32_t r = rgb[i] >> 16, g = (rgb[i] >> 8) & 0xFF, b = rgb[i] & 0xFF;
+        rgba[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
+    }
+    return rgba;
+}();
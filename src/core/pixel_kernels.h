@@ -0,0 +1,45 @@
+#ifndef NESEMULATOR_PIXEL_KERNELS_H
+#define NESEMULATOR_PIXEL_KERNELS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Sprite line buffer format: palette << 2 | pixel index in the low 4 bits, plus these flags.
+//Background line buffers hold palette << 2 | pixel index, 0 where transparent.
+constexpr uint8_t SPRITE_BEHIND = 0x20;
+constexpr uint8_t SPRITE_ZERO = 0x40;
+
+//The inner loops of the pixel path. Every implementation produces identical output; the
+//vector ones only exist to make it faster.
+struct PixelKernels {
+    const char *name;
+
+    //Splits tiles of 2-bitplane CHR (16 bytes each) into 64 pixel indices (0-3) per tile
+    void (*decode_tiles)(const uint8_t *chr, uint8_t *out, size_t tiles);
+
+    //Mixes a line of background and sprite pixels into palette RAM indices (0-31), applying
+    //sprite priority and left-column clipping (bg_left/sprite_left are 0 or 8). Returns the
+    //first x where sprite 0 hit the background, or -1; x = 255 never counts.
+    int (*mix_line)(const uint8_t *background, const uint8_t *sprites, uint8_t *out, int bg_left,
+                    int sprite_left);
+
+    //out[i] = palette[colors[i]] & mask, colors being palette RAM indices (0-31)
+    void (*lookup_palette)(const uint8_t *colors, const uint8_t *palette, uint8_t mask, uint8_t *out,
+                           size_t count);
+
+    //out[i] = table[indices[i]], indices being NES colors (0-63)
+    void (*expand_rgba)(const uint8_t *indices, const uint32_t *table, uint32_t *out, size_t count);
+};
+
+//The fastest kernels this CPU supports, picked on first use via CPUID
+const PixelKernels &pixel_kernels();
+
+//Every implementation this CPU can run, scalar first
+std::vector<const PixelKernels *> available_pixel_kernels();
+
+//2C02 colors as 0xAABBGGRR, i.e. R, G, B, A in memory order on little-endian hosts
+extern const std::array<uint32_t, 64> NES_PALETTE_RGBA;
+
+#endif //NESEMULATOR_PIXEL_KERNELS_H
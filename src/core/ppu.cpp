@@ -0,0 +1,527 @@
+#include "ppu.h"
+#include "render_thread.h"
+#include <algorithm>
+
+using namespace std;
+
+constexpr uint8_t CTRL_INCREMENT_32 = 0x04;
+constexpr uint8_t CTRL_SPRITE_TABLE = 0x08;
+constexpr uint8_t CTRL_BACKGROUND_TABLE = 0x10;
+constexpr uint8_t CTRL_SPRITE_SIZE = 0x20;
+constexpr uint8_t CTRL_NMI = 0x80;
+
+constexpr uint8_t MASK_GRAYSCALE = 0x01;
+constexpr uint8_t MASK_BACKGROUND_LEFT = 0x02;
+constexpr uint8_t MASK_SPRITES_LEFT = 0x04;
+constexpr uint8_t MASK_BACKGROUND = 0x08;
+constexpr uint8_t MASK_SPRITES = 0x10;
+
+constexpr uint8_t STATUS_OVERFLOW = 0x20;
+constexpr uint8_t STATUS_SPRITE_ZERO = 0x40;
+constexpr uint8_t STATUS_VBLANK = 0x80;
+
+
+TileCache::TileCache(span<const uint8_t> chr) : decoded(chr.size() * 4) {
+    pixel_kernels().decode_tiles(chr.data(), decoded.data(), chr.size() / 16);
+}
+
+void TileCache::write(uint32_t offset, uint8_t value) {
+    uint8_t *out = decoded.data() + ((offset >> 4) << 6) + ((offset & 7) << 3);
+    //Bytes 0-7 of a tile are bitplane 0, bytes 8-15 bitplane 1
+    int plane = (offset >> 3) & 1;
+    uint8_t keep = plane ? 1 : 2;
+    for (int px = 0; px < 8; px++)
+        out[px] = (out[px] & keep) | (((value >> (7 - px)) & 1) << plane);
+}
+
+
+PpuCore::PpuCore(span<const uint8_t> chr, const PixelKernels &kernels) : tiles(chr), kernels(kernels) {
+}
+
+void PpuCore::set_frame_target(FrameTarget target, void *context) {
+    frame_target = target;
+    target_context = context;
+}
+
+const uint8_t *PpuCore::finish_frame() {
+    const uint8_t *finished = pixels;
+    pixels = framebuffer.data();
+    return finished;
+}
+
+void PpuCore::reset() {
+    ctrl = 0;
+    mask = 0;
+    w = false;
+    read_buffer = 0;
+}
+
+bool PpuCore::rendering() const {
+    return mask & (MASK_BACKGROUND | MASK_SPRITES);
+}
+
+bool PpuCore::nmi_enabled() const {
+    return ctrl & CTRL_NMI;
+}
+
+bool PpuCore::take_nmi() {
+    bool edge = nmi_edge;
+    nmi_edge = false;
+    return edge;
+}
+
+//Write-only registers read back the last value on the bus
+uint8_t PpuCore::read_register(uint16_t address, Mapper *mapper) {
+    switch (address & 7) {
+        case 2:
+            latch = (status & 0xE0) | (latch & 0x1F);
+            status &= ~STATUS_VBLANK;
+            w = false;
+            break;
+        case 4:
+            latch = oam[oam_addr];
+            break;
+        case 7: {
+            uint16_t vram_addr = v & 0x3FFF;
+            if (vram_addr >= 0x3F00) {
+                //Palette reads are immediate; the buffer gets the nametable byte underneath
+                latch = (latch & 0xC0) | palette_entry(vram_addr);
+                read_buffer = vram_read(vram_addr - 0x1000, mapper);
+            } else {
+                latch = read_buffer;
+                read_buffer = vram_read(vram_addr, mapper);
+            }
+            v = (v + (ctrl & CTRL_INCREMENT_32 ? 32 : 1)) & 0x7FFF;
+            break;
+        }
+        default:
+            break;
+    }
+    return latch;
+}
+
+void PpuCore::write_register(uint16_t address, uint8_t value, Mapper *mapper) {
+    latch = value;
+    switch (address & 7) {
+        case 0:
+            //Enabling NMI during vblank fires it straight away
+            if (!(ctrl & CTRL_NMI) && (value & CTRL_NMI) && (status & STATUS_VBLANK))
+                nmi_edge = true;
+            ctrl = value;
+            t = (t & 0xF3FF) | ((value & 3) << 10);
+            break;
+        case 1:
+            mask = value;
+            break;
+        case 3:
+            oam_addr = value;
+            break;
+        case 4:
+            oam[oam_addr++] = value;
+            break;
+        case 5:
+            if (!w) {
+                t = (t & ~0x001F) | (value >> 3);
+                fine_x = value & 7;
+            } else {
+                t = (t & 0x8C1F) | ((value & 7) << 12) | ((value & 0xF8) << 2);
+            }
+            w = !w;
+            break;
+        case 6:
+            if (!w) {
+                t = (t & 0x00FF) | ((value & 0x3F) << 8);
+            } else {
+                t = (t & 0xFF00) | value;
+                v = t;
+            }
+            w = !w;
+            break;
+        case 7:
+            vram_write(v & 0x3FFF, value, mapper);
+            v = (v + (ctrl & CTRL_INCREMENT_32 ? 32 : 1)) & 0x7FFF;
+            break;
+        default:
+            break;
+    }
+}
+
+int PpuCore::run_line(int line, bool draw) {
+    int hit = -1;
+    if (line == 0 && draw) {
+        uint8_t *lent = frame_target ? frame_target(target_context) : nullptr;
+        pixels = lent ? lent : framebuffer.data();
+    }
+    if (line < SCREEN_HEIGHT) {
+        if (rendering()) {
+            bool hit_possible = !(status & STATUS_SPRITE_ZERO);
+            if (draw)
+                hit = draw_line(line, pixels + line * SCREEN_WIDTH);
+            else if (evaluate_sprites(line) && (mask & MASK_BACKGROUND) && hit_possible)
+                hit = draw_line(line, scratch_line.data());
+            if (!hit_possible)
+                hit = -1;
+            increment_y();
+            //Horizontal position reloads from t at the end of every line
+            v = (v & ~0x041F) | (t & 0x041F);
+        } else if (draw) {
+            fill_n(pixels + line * SCREEN_WIDTH, SCREEN_WIDTH, palette[0] & 0x3F);
+        }
+    } else if (line == VBLANK_LINE) {
+        status |= STATUS_VBLANK;
+    } else if (line == PRE_RENDER_LINE) {
+        status &= ~(STATUS_VBLANK | STATUS_SPRITE_ZERO | STATUS_OVERFLOW);
+        if (rendering())
+            v = t;
+    }
+    return hit;
+}
+
+void PpuCore::set_sprite_zero_hit() {
+    status |= STATUS_SPRITE_ZERO;
+}
+
+int PpuCore::a12_rise_dot() const {
+    if (!rendering())
+        return -1;
+    //Sprite pattern fetches run from dot 257; 8x16 sprites always touch $1000 through the
+    //dummy tile $FF fetches of empty slots
+    if ((ctrl & CTRL_SPRITE_TABLE) || (ctrl & CTRL_SPRITE_SIZE))
+        return 260;
+    //Otherwise the first background fetch for the next line, after sprites held A12 low
+    if (ctrl & CTRL_BACKGROUND_TABLE)
+        return 324;
+    return -1;
+}
+
+int PpuCore::draw_line(int y, uint8_t *out) {
+    //Background pixels are palette << 2 | index, 0 when transparent; one extra tile for fine x
+    array<uint8_t, SCREEN_WIDTH + 16> background = {};
+    //Sprite pixels are palette << 2 | index plus the SPRITE_ flags
+    array<uint8_t, SCREEN_WIDTH> sprites = {};
+    if (mask & MASK_BACKGROUND)
+        render_background(background.data());
+    if (mask & MASK_SPRITES)
+        render_sprites(y, sprites.data());
+
+    array<uint8_t, SCREEN_WIDTH> colors;
+    int hit = kernels.mix_line(background.data() + fine_x, sprites.data(), colors.data(),
+                               mask & MASK_BACKGROUND_LEFT ? 0 : 8, mask & MASK_SPRITES_LEFT ? 0 : 8);
+    //Mixed colors never land on the $3F10/$3F14/... mirrors, so palette RAM is indexed directly
+    kernels.lookup_palette(colors.data(), palette.data(), mask & MASK_GRAYSCALE ? 0x30 : 0x3F, out, SCREEN_WIDTH);
+    return hit;
+}
+
+bool PpuCore::evaluate_sprites(int y) {
+    if (!(mask & MASK_SPRITES))
+        return false;
+    int height = ctrl & CTRL_SPRITE_SIZE ? 16 : 8;
+    int count = 0;
+    bool zero = false;
+    for (int i = 0; i < 64; i++) {
+        int row = y - 1 - oam[i * 4];
+        if (row < 0 || row >= height)
+            continue;
+        zero |= i == 0;
+        if (++count > 8) {
+            status |= STATUS_OVERFLOW;
+            break;
+        }
+    }
+    return zero;
+}
+
+void PpuCore::render_background(uint8_t *pixels) {
+    uint16_t addr = v;
+    uint16_t table = ctrl & CTRL_BACKGROUND_TABLE ? 0x1000 : 0;
+    for (int tile = 0; tile < SCREEN_WIDTH / 8 + 1; tile++) {
+        uint8_t index = *nametable(0x2000 | (addr & 0x0FFF));
+        uint8_t attribute = *nametable(0x23C0 | (addr & 0x0C00) | ((addr >> 4) & 0x38) | ((addr >> 2) & 0x07));
+        int shift = ((addr >> 4) & 4) | (addr & 2);
+        uint8_t palette_bits = ((attribute >> shift) & 3) << 2;
+        const uint8_t *row = tile_row(table | (index << 4) | ((addr >> 12) & 7));
+        for (int px = 0; px < 8; px++)
+            pixels[px] = row[px] ? palette_bits | row[px] : 0;
+        pixels += 8;
+        //Coarse x wraps into the horizontally adjacent nametable
+        if ((addr & 0x001F) == 31) {
+            addr &= ~0x001F;
+            addr ^= 0x0400;
+        } else {
+            addr++;
+        }
+    }
+}
+
+void PpuCore::render_sprites(int y, uint8_t *pixels) {
+    int height = ctrl & CTRL_SPRITE_SIZE ? 16 : 8;
+    int count = 0;
+    for (int i = 0; i < 64; i++) {
+        const uint8_t *sprite = oam.data() + i * 4;
+        //Sprites are evaluated a line ahead, so they appear one line below their Y
+        int row = y - 1 - sprite[0];
+        if (row < 0 || row >= height)
+            continue;
+        if (++count > 8) {
+            status |= STATUS_OVERFLOW;
+            break;
+        }
+        uint8_t attributes = sprite[2];
+        if (attributes & 0x80)
+            row = height - 1 - row;
+        uint16_t address;
+        if (height == 16) {
+            uint8_t index = sprite[1];
+            address = ((index & 1) << 12) | ((index & 0xFE) << 4) | (row & 8 ? 16 : 0) | (row & 7);
+        } else {
+            address = (ctrl & CTRL_SPRITE_TABLE ? 0x1000 : 0) | (sprite[1] << 4) | row;
+        }
+        const uint8_t *pixel_row = tile_row(address);
+        uint8_t bits = ((attributes & 3) << 2) | (attributes & 0x20 ? SPRITE_BEHIND : 0) | (i == 0 ? SPRITE_ZERO : 0);
+        for (int px = 0; px < 8 && sprite[3] + px < SCREEN_WIDTH; px++) {
+            uint8_t index = pixel_row[attributes & 0x40 ? 7 - px : px];
+            //Lower OAM indices win, even when they are behind the background
+            if (!index || (pixels[sprite[3] + px] & 3))
+                continue;
+            pixels[sprite[3] + px] = bits | index;
+        }
+    }
+}
+
+uint8_t *PpuCore::nametable(uint16_t address) {
+    int table = (address >> 10) & 3;
+    switch (banks.mirroring) {
+        case Mirroring::HORIZONTAL:
+            table >>= 1;
+            break;
+        case Mirroring::VERTICAL:
+            table &= 1;
+            break;
+        case Mirroring::SINGLE_SCREEN_LOW:
+            table = 0;
+            break;
+        case Mirroring::SINGLE_SCREEN_HIGH:
+            table = 1;
+            break;
+        case Mirroring::FOUR_SCREEN:
+            break;
+    }
+    return ciram.data() + table * 0x400 + (address & 0x3FF);
+}
+
+const uint8_t *PpuCore::tile_row(uint16_t address) const {
+    return tiles.row(banks.offsets[address >> 10] + (address & 0x3FF));
+}
+
+uint8_t PpuCore::vram_read(uint16_t address, Mapper *mapper) {
+    if (address < 0x2000)
+        return mapper ? mapper->chr_read(address >> 10)[address & 0x3FF] : 0;
+    if (address < 0x3F00)
+        return *nametable(address);
+    return palette_entry(address);
+}
+
+void PpuCore::vram_write(uint16_t address, uint8_t value, Mapper *mapper) {
+    if (address < 0x2000) {
+        if (!banks.writable)
+            return;
+        int slot = address >> 10;
+        if (mapper)
+            mapper->chr_write(slot)[address & 0x3FF] = value;
+        tiles.write(banks.offsets[slot] + (address & 0x3FF), value);
+    } else if (address < 0x3F00) {
+        *nametable(address) = value;
+    } else {
+        palette_entry(address) = value & 0x3F;
+    }
+}
+
+//$3F10/$3F14/$3F18/$3F1C are the backdrop entries of the background palettes
+uint8_t &PpuCore::palette_entry(uint16_t address) {
+    uint8_t index = address & 0x1F;
+    if ((index & 0x13) == 0x10)
+        index &= 0x0F;
+    return palette[index];
+}
+
+void PpuCore::increment_y() {
+    if ((v & 0x7000) != 0x7000) {
+        v += 0x1000;
+        return;
+    }
+    v &= ~0x7000;
+    int coarse_y = (v & 0x03E0) >> 5;
+    if (coarse_y == 29) {
+        coarse_y = 0;
+        v ^= 0x0800;
+    } else if (coarse_y == 31) {
+        coarse_y = 0;
+    } else {
+        coarse_y++;
+    }
+    v = (v & ~0x03E0) | (coarse_y << 5);
+}
+
+Ppu::Ppu(Mapper &mapper, bool threaded) : mapper(mapper), core(mapper.chr(), pixel_kernels()) {
+    core.banks = current_banks();
+    if (threaded)
+        renderer = make_unique<RenderThread>(mapper.chr(), pixel_kernels(), core.banks);
+}
+
+Ppu::~Ppu() = default;
+
+void Ppu::attach(Memory &memory, Scheduler &sched, InterruptLines &lines, uint64_t now) {
+    scheduler = &sched;
+    interrupts = &lines;
+    memory.map_mmio(0x20, 0x20, {register_read, register_write, this});
+    line_event = scheduler->add_event(scanline_event, this);
+    sprite_zero_event = scheduler->add_event(sprite_zero_hit_event, this);
+    a12_event = scheduler->add_event(a12_rise_event, this);
+    line = PRE_RENDER_LINE;
+    line_dot = now * DOTS_PER_CPU_CYCLE;
+    scheduler->schedule(line_event, now);
+}
+
+void Ppu::reset() {
+    core.reset();
+    if (renderer)
+        renderer->reset();
+    odd_frame = false;
+}
+
+const Framebuffer &Ppu::frame() {
+    if (!renderer)
+        return core.framebuffer;
+    renderer->sync();
+    return renderer->framebuffer();
+}
+
+void Ppu::frame_rgba(uint32_t *out) {
+    const Framebuffer &pixels = frame();
+    pixel_kernels().expand_rgba(pixels.data(), NES_PALETTE_RGBA.data(), out, pixels.size());
+}
+
+void Ppu::set_frame_callback(FrameCallback callback, void *context) {
+    if (renderer) {
+        renderer->sync();
+        renderer->set_frame_callback(callback, context);
+    }
+    frame_callback = callback;
+    frame_context = context;
+}
+
+void Ppu::set_frame_target(FrameTarget target, void *context) {
+    if (renderer) {
+        renderer->sync();
+        renderer->set_frame_target(target, context);
+    } else {
+        core.set_frame_target(target, context);
+    }
+}
+
+void Ppu::set_frame_rendering(bool enabled) {
+    draw_requested = enabled;
+}
+
+void Ppu::sync() {
+    if (renderer)
+        renderer->sync();
+}
+
+ChrBanks Ppu::current_banks() const {
+    ChrBanks banks;
+    for (int slot = 0; slot < CHR_SLOTS; slot++)
+        banks.offsets[slot] = mapper.chr_offset(slot);
+    banks.mirroring = mapper.mirroring();
+    banks.writable = mapper.chr_write(0) != nullptr;
+    return banks;
+}
+
+//The core only sees the mapper's banking when it is refreshed: before $2007 accesses and
+//at the start of every scanline
+void Ppu::refresh_banks() {
+    ChrBanks banks = current_banks();
+    if (banks == core.banks)
+        return;
+    core.banks = banks;
+    if (renderer)
+        renderer->set_banks(banks);
+}
+
+uint8_t Ppu::register_read(void *context, uint16_t address) {
+    auto *ppu = static_cast<Ppu *>(context);
+    int reg = address & 7;
+    if (reg == 7)
+        ppu->refresh_banks();
+    uint8_t value = ppu->core.read_register(address, &ppu->mapper);
+    //Only $2002 and $2007 reads change state
+    if (ppu->renderer && (reg == 2 || reg == 7))
+        ppu->renderer->read(address);
+    return value;
+}
+
+void Ppu::register_write(void *context, uint16_t address, uint8_t value) {
+    auto *ppu = static_cast<Ppu *>(context);
+    if ((address & 7) == 7)
+        ppu->refresh_banks();
+    ppu->core.write_register(address, value, &ppu->mapper);
+    if (ppu->core.take_nmi())
+        ppu->interrupts->trigger_nmi();
+    if (ppu->renderer)
+        ppu->renderer->write(address, value);
+}
+
+void Ppu::scanline_event(void *context, uint64_t time) {
+    auto *ppu = static_cast<Ppu *>(context);
+    ppu->run_scanline();
+    ppu->scheduler->schedule(ppu->line_event, ppu->line_dot / DOTS_PER_CPU_CYCLE);
+}
+
+void Ppu::sprite_zero_hit_event(void *context, uint64_t time) {
+    static_cast<Ppu *>(context)->core.set_sprite_zero_hit();
+}
+
+void Ppu::a12_rise_event(void *context, uint64_t time) {
+    static_cast<Ppu *>(context)->mapper.clock_scanline();
+}
+
+void Ppu::run_scanline() {
+    refresh_banks();
+    //Frames are drawn or skipped whole, so a toggle mid-frame waits for the next one
+    if (line == PRE_RENDER_LINE)
+        draw_frame = draw_requested;
+    //The line runs in one go at its start; the two effects the CPU can observe within it
+    //are posted for the dot they really happen on
+    if (line < SCREEN_HEIGHT || line == PRE_RENDER_LINE) {
+        int dot = core.a12_rise_dot();
+        if (dot >= 0)
+            scheduler->schedule(a12_event, (line_dot + dot) / DOTS_PER_CPU_CYCLE);
+    }
+    //Pixel x comes out on dot x + 1
+    int hit = core.run_line(line, draw_frame && !renderer);
+    if (hit >= 0)
+        scheduler->schedule(sprite_zero_event, (line_dot + hit + 1) / DOTS_PER_CPU_CYCLE);
+    if (line == VBLANK_LINE)
+        frames++;
+    if (renderer)
+        renderer->run_line(line, draw_frame, frames);
+    if (line == VBLANK_LINE) {
+        if (core.nmi_enabled())
+            interrupts->trigger_nmi();
+        if (!renderer && draw_frame) {
+            const uint8_t *pixels = core.finish_frame();
+            if (frame_callback)
+                frame_callback(frame_context, pixels, frames);
+        }
+    }
+
+    int dots = DOTS_PER_SCANLINE;
+    //Odd frames skip a dot at the end of the pre-render line while rendering
+    if (line == PRE_RENDER_LINE && odd_frame && core.rendering())
+        dots--;
+    line_dot += dots;
+    if (++line == SCANLINES_PER_FRAME) {
+        line = 0;
+        odd_frame = !odd_frame;
+    }
+}
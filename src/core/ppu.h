@@ -0,0 +1,257 @@
+#ifndef NESEMULATOR_PPU_H
+#define NESEMULATOR_PPU_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+#include "state.h"
+#include "mapper.h"
+#include "scheduler.h"
+#include "pixel_kernels.h"
+
+constexpr int SCREEN_WIDTH = 256;
+constexpr int SCREEN_HEIGHT = 240;
+constexpr int DOTS_PER_SCANLINE = 341;
+constexpr int SCANLINES_PER_FRAME = 262;
+constexpr int DOTS_PER_CPU_CYCLE = 3; // NTSC
+constexpr int VBLANK_LINE = 241;
+constexpr int PRE_RENDER_LINE = SCANLINES_PER_FRAME - 1;
+
+using Framebuffer = std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT>;
+
+//Called with each finished frame of palette indices, on whichever thread rendered it
+typedef void (*FrameCallback)(void *context, const uint8_t *pixels, uint64_t frame);
+
+//Lends SCREEN_WIDTH * SCREEN_HEIGHT bytes to draw the next frame straight into, on the
+//thread that renders it; the frame callback gets the same pointer back once it's finished.
+//Null has the frame drawn into the PPU's own framebuffer.
+typedef uint8_t *(*FrameTarget)(void *context);
+
+//Pattern tables decoded from the 2-bitplane format into one 0-3 pixel index per byte, so
+//rendering a tile row is a copy rather than 8 bit extractions. Covers the whole CHR data
+//and is addressed by CHR offset, so bank switches never invalidate it; only CHR-RAM
+//writes do, and those patch the row they touch.
+class TileCache {
+public:
+    explicit TileCache(std::span<const uint8_t> chr);
+
+    //The 8 pixels of the tile row holding CHR byte offset
+    [[nodiscard]] const uint8_t *row(uint32_t offset) const {
+        return decoded.data() + ((offset >> 4) << 6) + ((offset & 7) << 3);
+    }
+
+    //CHR-RAM offset was written. The other bitplane comes from the decoded pixels, so the
+    //cache never reads CHR memory after construction.
+    void write(uint32_t offset, uint8_t value);
+
+private:
+    std::vector<uint8_t> decoded;
+};
+
+//How the mapper had CHR banked and the nametables mirrored at some point in time
+struct ChrBanks {
+    std::array<uint32_t, CHR_SLOTS> offsets = {};
+    Mirroring mirroring = Mirroring::HORIZONTAL;
+    //CHR-RAM rather than ROM
+    bool writable = false;
+
+    bool operator==(const ChrBanks &) const = default;
+};
+
+//The 2C02's registers, memories and drawing code, without any tie to the CPU bus or the
+//clock. Ppu drives one directly; in threaded mode the render thread drives a second copy
+//by replaying what happened to the first.
+class PpuCore {
+public:
+    PpuCore(std::span<const uint8_t> chr, const PixelKernels &kernels);
+
+    //pixels points into the core's own framebuffer
+    PpuCore(const PpuCore &) = delete;
+
+    PpuCore &operator=(const PpuCore &) = delete;
+
+    //Register access from the CPU, mirrored every 8 bytes. mapper backs $2007 CHR access;
+    //it is null on the render thread, where read results are never looked at.
+    uint8_t read_register(uint16_t address, Mapper *mapper);
+
+    void write_register(uint16_t address, uint8_t value, Mapper *mapper);
+
+    //Runs scanline line (0-261). Visible lines are drawn when draw is set; otherwise only
+    //sprite 0 hit and overflow are worked out, drawing just the lines sprite 0 is on.
+    //Returns the x where sprite 0 first hits on this line, or -1. The status bit is left to
+    //the caller, which knows when that dot comes round.
+    int run_line(int line, bool draw);
+
+    void set_sprite_zero_hit();
+
+    //The dot of a rendering line on which PPU A12 rises for the first time after the
+    //long low stretch the MMC3 filters for, or -1 when it stays low (both pattern tables
+    //at $0000 with 8x8 sprites)
+    [[nodiscard]] int a12_rise_dot() const;
+
+    void reset();
+
+    [[nodiscard]] bool rendering() const;
+
+    [[nodiscard]] bool nmi_enabled() const;
+
+    //True once after a PPUCTRL write enabled NMI in the middle of vblank
+    bool take_nmi();
+
+    //Drawn frames go to buffers target lends from the next frame on
+    void set_frame_target(FrameTarget target, void *context);
+
+    //The pixels of the frame just finished, framebuffer or a lent buffer; a lent buffer is
+    //given up with it
+    const uint8_t *finish_frame();
+
+    ChrBanks banks;
+    Framebuffer framebuffer = {};
+
+private:
+    //Returns the sprite 0 hit x, or -1
+    int draw_line(int y, uint8_t *out);
+
+    void render_background(uint8_t *pixels);
+
+    void render_sprites(int y, uint8_t *pixels);
+
+    //Sets overflow and returns whether sprite 0 is on the line, without drawing anything
+    bool evaluate_sprites(int y);
+
+    uint8_t *nametable(uint16_t address);
+
+    [[nodiscard]] const uint8_t *tile_row(uint16_t address) const;
+
+    uint8_t vram_read(uint16_t address, Mapper *mapper);
+
+    void vram_write(uint16_t address, uint8_t value, Mapper *mapper);
+
+    uint8_t &palette_entry(uint16_t address);
+
+    void increment_y();
+
+    TileCache tiles;
+    const PixelKernels &kernels;
+    FrameTarget frame_target = nullptr;
+    void *target_context = nullptr;
+    //Where visible lines are drawn this frame
+    uint8_t *pixels = framebuffer.data();
+
+    //Loopy's scroll registers: v/t are 15-bit VRAM addresses, x the fine scroll, w the write toggle
+    uint16_t v = 0;
+    uint16_t t = 0;
+    uint8_t fine_x = 0;
+    bool w = false;
+
+    uint8_t ctrl = 0;
+    uint8_t mask = 0;
+    uint8_t status = 0;
+    uint8_t oam_addr = 0;
+    uint8_t read_buffer = 0;
+    uint8_t latch = 0;
+    bool nmi_edge = false;
+
+    std::array<uint8_t, 0x100> oam = {};
+    std::array<uint8_t, 0x20> palette = {};
+    //4KB so four-screen boards have their extra tables; others mirror into the first 2KB
+    std::array<uint8_t, 0x1000> ciram = {};
+    std::array<uint8_t, SCREEN_WIDTH> scratch_line = {};
+};
+
+class RenderThread;
+
+//Scanline-based 2C02 on the CPU bus. Each scanline runs in one go when the scheduler
+//reaches its start, so register writes take effect at scanline granularity. The
+//framebuffer holds palette indices (0-63); see frame_rgba() for colors.
+//
+//Threaded, the CPU-side core only keeps the timing model ($2002 answers, NMI, the mapper's
+//scanline clock) and a render thread draws the pixels from a log of register accesses.
+//With frame rendering off, nothing draws the pixels at all.
+class Ppu {
+public:
+    explicit Ppu(Mapper &mapper, bool threaded = false);
+
+    ~Ppu();
+
+    Ppu(const Ppu &) = delete;
+
+    Ppu &operator=(const Ppu &) = delete;
+
+    //Takes over $2000-$3FFF and starts the frame at the pre-render line at cycle now
+    void attach(Memory &memory, Scheduler &scheduler, InterruptLines &lines, uint64_t now);
+
+    void reset();
+
+    //The last drawn frame. Threaded, this first waits for the render thread to catch up.
+    [[nodiscard]] const Framebuffer &frame();
+
+    //The framebuffer through NES_PALETTE_RGBA; out holds SCREEN_WIDTH * SCREEN_HEIGHT pixels
+    void frame_rgba(uint32_t *out);
+
+    //Receives every frame as it is finished; threaded, it runs on the render thread
+    void set_frame_callback(FrameCallback callback, void *context);
+
+    //Has frames drawn into buffers target lends rather than the framebuffer, which frame()
+    //then no longer shows; the frame callback hands each one back. Takes effect from the
+    //next frame.
+    void set_frame_target(FrameTarget target, void *context);
+
+    //Skipping rendering still runs the timing model: vblank, NMI, sprite 0 hit, sprite
+    //overflow and the MMC3 scanline clock behave the same, but no pixels are composed and
+    //the frame callback is not called. Takes effect from the next frame.
+    void set_frame_rendering(bool enabled);
+
+    //Blocks until the render thread has drawn everything logged so far (no-op unthreaded)
+    void sync();
+
+    //Frames completed (incremented at the start of vblank)
+    [[nodiscard]] uint64_t frame_count() const {
+        return frames;
+    }
+
+    //The scanline the next event runs, 0-239 visible, 261 pre-render
+    [[nodiscard]] int scanline() const {
+        return line;
+    }
+
+private:
+    static uint8_t register_read(void *context, uint16_t address);
+
+    static void register_write(void *context, uint16_t address, uint8_t value);
+
+    static void scanline_event(void *context, uint64_t time);
+
+    static void sprite_zero_hit_event(void *context, uint64_t time);
+
+    static void a12_rise_event(void *context, uint64_t time);
+
+    void run_scanline();
+
+    [[nodiscard]] ChrBanks current_banks() const;
+
+    void refresh_banks();
+
+    Mapper &mapper;
+    PpuCore core;
+    std::unique_ptr<RenderThread> renderer;
+    FrameCallback frame_callback = nullptr;
+    void *frame_context = nullptr;
+    Scheduler *scheduler = nullptr;
+    InterruptLines *interrupts = nullptr;
+    int line_event = -1;
+    int sprite_zero_event = -1;
+    int a12_event = -1;
+
+    int line = SCANLINES_PER_FRAME - 1;
+    uint64_t line_dot = 0;
+    uint64_t frames = 0;
+    bool odd_frame = false;
+    bool draw_requested = true;
+    //draw_requested as of the current frame's pre-render line
+    bool draw_frame = true;
+};
+
+#endif //NESEMULATOR_PPU_H
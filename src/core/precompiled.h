@@ -0,0 +1,32 @@
+#ifndef NESEMULATOR_PRECOMPILED_H
+#define NESEMULATOR_PRECOMPILED_H
+
+#include <cstdint>
+#include <span>
+#include "jit.h"
+
+//C++ generated by NESRecompiler (tools/recompiler.cpp) for one NROM image, run in
+//CpuMode::PRECOMPILED. There's a function per basic block of the code traced from the
+//vectors, and a loop dispatching between them on PC; code it doesn't have (RAM, targets of
+//indirect jumps it couldn't follow) is left to the block cache.
+struct PrecompiledRom {
+    //What it was compiled from, see prg_rom_hash()
+    uint64_t prg_size;
+    uint64_t prg_hash;
+    //Runs compiled blocks from PC for as long as the interpreter loop would run straight
+    //through, with the same frame and exits as Jit::run. Returns whether frame.stop ended the
+    //run; runs nothing when PC isn't the start of a compiled block.
+    bool (*run)(JitFrame &frame);
+};
+
+//FNV-1a, so code is only ever run against the image it was compiled from
+inline uint64_t prg_rom_hash(std::span<const uint8_t> prg) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (uint8_t byte : prg) {
+        hash ^= byte;
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+#endif //NESEMULATOR_PRECOMPILED_H
@@ -0,0 +1,56 @@
+#ifndef NESEMULATOR_PRECOMPILED_RUN_H
+#define NESEMULATOR_PRECOMPILED_RUN_H
+
+#include <cstdint>
+#include "handlers.h"
+#include "precompiled.h"
+
+//Included by the C++ NESRecompiler generates, and by nothing else
+
+//How a generated block finished
+enum class PrecompiledExit {
+    //On to whatever block PC is at now
+    NEXT,
+    //Back to the interpreter loop: something is due, or an interrupt may be taken
+    LEAVE,
+    STOP
+};
+
+//What generated blocks run with: the frame, its budget and opcode held in locals until
+//leave(). Blocks are static and called once, so all of this inlines into the dispatch loop.
+class PrecompiledRun {
+public:
+    explicit PrecompiledRun(JitFrame &frame) : frame(frame), budget(frame.budget), opcode(frame.opcode) {}
+
+    [[nodiscard]] uint16_t pc() {
+        return frame.state->reg().getPC().addr;
+    }
+
+    //The interpreter loop's checks before each instruction, as in native JIT code
+    [[nodiscard]] bool may_continue() const {
+        return budget > 0 && budget > frame.event_budget &&
+               (frame.lines->irq | frame.lines->nmi << 8) == frame.entry_lines && *frame.stall == 0;
+    }
+
+    //Runs one instruction; returns whether stop holds after it
+    template<uint8_t op>
+    bool step(uint16_t operand, uint16_t next_pc) {
+        *frame.clock = frame.deadline - budget;
+        budget -= replay_opcode<op>(*frame.state, {nullptr, operand, next_pc, op});
+        opcode = op;
+        return frame.stop && frame.stop(frame.stop_context, *frame.state);
+    }
+
+    bool leave(PrecompiledExit exit) {
+        frame.budget = budget;
+        frame.opcode = opcode;
+        return exit == PrecompiledExit::STOP;
+    }
+
+private:
+    JitFrame &frame;
+    int64_t budget;
+    uint8_t opcode;
+};
+
+#endif //NESEMULATOR_PRECOMPILED_RUN_H
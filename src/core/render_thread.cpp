@@ -0,0 +1,108 @@
+#include "render_thread.h"
+
+using namespace std;
+
+RenderThread::RenderThread(span<const uint8_t> chr, const PixelKernels &kernels, const ChrBanks &banks)
+        : ring(CAPACITY), replica(chr, kernels) {
+    replica.banks = banks;
+    worker = thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread() {
+    push({lines_logged, PpuLogEntry::STOP}, true);
+    worker.join();
+}
+
+void RenderThread::read(uint16_t address) {
+    push({lines_logged, PpuLogEntry::READ, address}, false);
+}
+
+void RenderThread::write(uint16_t address, uint8_t value) {
+    push({lines_logged, PpuLogEntry::WRITE, address, value}, false);
+}
+
+void RenderThread::set_banks(const ChrBanks &banks) {
+    push({lines_logged, PpuLogEntry::BANKS, 0, 0, banks}, false);
+}
+
+void RenderThread::run_line(int line, bool draw, uint64_t frame) {
+    push({lines_logged++, PpuLogEntry::LINE, static_cast<uint16_t>(line), draw, {}, frame}, true);
+}
+
+void RenderThread::reset() {
+    push({lines_logged, PpuLogEntry::RESET}, false);
+}
+
+void RenderThread::sync() {
+    head.notify_one();
+    uint64_t done = tail.load(memory_order_acquire);
+    while (done != next) {
+        tail.wait(done, memory_order_acquire);
+        done = tail.load(memory_order_acquire);
+    }
+}
+
+void RenderThread::set_frame_callback(FrameCallback callback, void *context) {
+    frame_callback = callback;
+    frame_context = context;
+}
+
+void RenderThread::set_frame_target(FrameTarget target, void *context) {
+    replica.set_frame_target(target, context);
+}
+
+void RenderThread::push(const PpuLogEntry &entry, bool wake) {
+    uint64_t done = tail.load(memory_order_acquire);
+    while (next - done >= CAPACITY) {
+        head.notify_one();
+        tail.wait(done, memory_order_acquire);
+        done = tail.load(memory_order_acquire);
+    }
+    ring[next & (CAPACITY - 1)] = entry;
+    head.store(++next, memory_order_release);
+    //Register accesses are batched up to the end of their scanline
+    if (wake)
+        head.notify_one();
+}
+
+void RenderThread::run() {
+    uint64_t position = 0;
+    while (true) {
+        uint64_t end = head.load(memory_order_acquire);
+        if (end == position) {
+            head.wait(end, memory_order_acquire);
+            continue;
+        }
+        for (; position != end; position++) {
+            const PpuLogEntry &entry = ring[position & (CAPACITY - 1)];
+            switch (entry.kind) {
+                case PpuLogEntry::READ:
+                    replica.read_register(entry.address, nullptr);
+                    break;
+                case PpuLogEntry::WRITE:
+                    replica.write_register(entry.address, entry.value, nullptr);
+                    break;
+                case PpuLogEntry::BANKS:
+                    replica.banks = entry.banks;
+                    break;
+                case PpuLogEntry::LINE:
+                    replica.run_line(entry.address, entry.value);
+                    if (entry.address == VBLANK_LINE && entry.value) {
+                        const uint8_t *pixels = replica.finish_frame();
+                        if (frame_callback)
+                            frame_callback(frame_context, pixels, entry.frame);
+                    }
+                    break;
+                case PpuLogEntry::RESET:
+                    replica.reset();
+                    break;
+                case PpuLogEntry::STOP:
+                    tail.store(position + 1, memory_order_release);
+                    tail.notify_all();
+                    return;
+            }
+        }
+        tail.store(position, memory_order_release);
+        tail.notify_all();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef NESEMULATOR_RENDER_THREAD_H
+#define NESEMULATOR_RENDER_THREAD_H
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+#include "ppu.h"
+
+//One thing that happened to the CPU-side PPU, stamped with the scanline count at the time
+struct PpuLogEntry {
+    enum Kind : uint8_t {
+        READ,
+        WRITE,
+        BANKS,
+        LINE,
+        RESET,
+        STOP
+    };
+
+    uint64_t stamp;
+    Kind kind;
+    //READ/WRITE: the register address; LINE: the scanline
+    uint16_t address;
+    //WRITE: the value; LINE: whether to draw it
+    uint8_t value;
+    ChrBanks banks;
+    //LINE: the PPU's frame count, handed to the frame callback as in unthreaded rendering
+    uint64_t frame;
+};
+
+//Draws frames on a worker thread. The CPU thread appends to a single-producer/single-consumer
+//ring and the worker replays it into its own PpuCore, so it renders frame N while the CPU
+//runs frame N+1. The producer only blocks when the ring is full.
+class RenderThread {
+public:
+    RenderThread(std::span<const uint8_t> chr, const PixelKernels &kernels, const ChrBanks &banks);
+
+    ~RenderThread();
+
+    RenderThread(const RenderThread &) = delete;
+
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    void read(uint16_t address);
+
+    void write(uint16_t address, uint8_t value);
+
+    void set_banks(const ChrBanks &banks);
+
+    //Ends the batch for scanline line and wakes the worker. Undrawn lines only keep the
+    //replica's scroll in step; the callback is skipped for undrawn frames. frame is the
+    //PPU's frame count (Ppu::frame_count).
+    void run_line(int line, bool draw, uint64_t frame);
+
+    void reset();
+
+    //Blocks until the worker has replayed everything appended so far
+    void sync();
+
+    //Only stable after sync()
+    [[nodiscard]] const Framebuffer &framebuffer() const {
+        return replica.framebuffer;
+    }
+
+    //Call after sync(); the worker picks it up with the next entry
+    void set_frame_callback(FrameCallback callback, void *context);
+
+    //Call after sync(), as set_frame_callback; target is called on the worker
+    void set_frame_target(FrameTarget target, void *context);
+
+private:
+    static constexpr uint64_t CAPACITY = 1 << 14;
+
+    void push(const PpuLogEntry &entry, bool wake);
+
+    void run();
+
+    std::vector<PpuLogEntry> ring;
+    //head is only written by the CPU thread, tail only by the worker; kept on separate lines
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+    alignas(64) uint64_t next = 0;
+    uint64_t lines_logged = 0;
+
+    PpuCore replica;
+    FrameCallback frame_callback = nullptr;
+    void *frame_context = nullptr;
+    std::thread worker;
+};
+
+#endif //NESEMULATOR_RENDER_THREAD_H
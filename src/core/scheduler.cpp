@@ -0,0 +1,73 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+bool Scheduler::later(const Entry &a, const Entry &b) {
+    return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+}
+
+int Scheduler::add_event(EventCallback callback, void *context) {
+    if (slot_count == MAX_EVENTS)
+        throw std::length_error("Scheduler: out of event slots");
+    slots[slot_count].callback = callback;
+    slots[slot_count].context = context;
+    return slot_count++;
+}
+
+void Scheduler::schedule(int id, uint64_t time) {
+    Slot &slot = slots.at(id);
+    //Any entry already in the heap for this slot goes stale; prune() skips it later
+    slot.sequence = next_sequence++;
+    slot.pending = true;
+    heap.push_back(Entry{time, slot.sequence, id});
+    std::push_heap(heap.begin(), heap.end(), later);
+    if (heap.size() > 4 * MAX_EVENTS)
+        compact();
+    prune();
+}
+
+void Scheduler::cancel(int id) {
+    slots.at(id).pending = false;
+    prune();
+}
+
+bool Scheduler::pending(int id) const {
+    return slots.at(id).pending;
+}
+
+void Scheduler::run_due(uint64_t now) {
+    while (!heap.empty() && heap.front().time <= now) {
+        Entry entry = heap.front();
+        std::pop_heap(heap.begin(), heap.end(), later);
+        heap.pop_back();
+        Slot &slot = slots[entry.id];
+        slot.pending = false;
+        slot.callback(slot.context, entry.time);
+        prune();
+    }
+}
+
+void Scheduler::clear() {
+    heap.clear();
+    for (Slot &slot: slots)
+        slot.pending = false;
+}
+
+void Scheduler::compact() {
+    std::erase_if(heap, [this](const Entry &entry) {
+        const Slot &slot = slots[entry.id];
+        return !slot.pending || slot.sequence != entry.sequence;
+    });
+    std::make_heap(heap.begin(), heap.end(), later);
+}
+
+void Scheduler::prune() {
+    while (!heap.empty()) {
+        const Entry &top = heap.front();
+        const Slot &slot = slots[top.id];
+        if (slot.pending && slot.sequence == top.sequence)
+            return;
+        std::pop_heap(heap.begin(), heap.end(), later);
+        heap.pop_back();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef NESEMULATOR_SCHEDULER_H
+#define NESEMULATOR_SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//Called with the timestamp the event was scheduled for, which may be a few cycles before
+//the current clock. Periodic events should reschedule relative to it to avoid drift.
+typedef void (*EventCallback)(void *context, uint64_t time);
+
+constexpr uint64_t NO_EVENT = std::numeric_limits<uint64_t>::max();
+
+//Orders peripheral events on master-clock timestamps, so the CPU can run uninterrupted
+//up to next_time() instead of ticking every component each cycle. Each event source owns
+//one slot and has at most one pending timestamp; scheduling it again replaces it.
+class Scheduler {
+public:
+    static constexpr int MAX_EVENTS = 8;
+
+    //Returns the slot id for schedule/cancel
+    int add_event(EventCallback callback, void *context);
+
+    void schedule(int id, uint64_t time);
+
+    void cancel(int id);
+
+    [[nodiscard]] bool pending(int id) const;
+
+    //Earliest pending timestamp, NO_EVENT when idle
+    [[nodiscard]] uint64_t next_time() const {
+        return heap.empty() ? NO_EVENT : heap.front().time;
+    }
+
+    //Fires every event due at or before now, in timestamp order; ties go in the order they
+    //were scheduled. Callbacks may schedule further events, including ones already due.
+    void run_due(uint64_t now);
+
+    //Drops all pending events but keeps the slots
+    void clear();
+
+    //DMA holding the CPU off the bus: the CPU loses this many cycles at its next instruction
+    //boundary (any cycle, when cycle-stepped), one more with align when that's an odd cycle
+    void stall_cpu(uint32_t cycles, bool align = false) {
+        stalled += cycles;
+        stall_aligned |= align;
+    }
+
+    //Stall cycles not yet taken; compiled code holds on to it to leave as soon as there are any
+    [[nodiscard]] const uint32_t &pending_stall() const {
+        return stalled;
+    }
+
+    //The stall cycles posted since the last call, for a stall starting at cycle at
+    uint32_t take_stall(uint64_t at) {
+        uint32_t cycles = stalled + (stall_aligned && (at & 1));
+        stalled = 0;
+        stall_aligned = false;
+        return cycles;
+    }
+
+private:
+    struct Entry {
+        uint64_t time;
+        uint64_t sequence;
+        int id;
+    };
+
+    struct Slot {
+        EventCallback callback = nullptr;
+        void *context = nullptr;
+        uint64_t sequence = 0;
+        bool pending = false;
+    };
+
+    static bool later(const Entry &a, const Entry &b);
+
+    //Pops stale entries (cancelled or rescheduled) off the top of the heap
+    void prune();
+
+    //Drops every stale entry; keeps the heap from growing when events are rescheduled often
+    void compact();
+
+    std::vector<Entry> heap;
+    std::array<Slot, MAX_EVENTS> slots = {};
+    int slot_count = 0;
+    uint64_t next_sequence = 0;
+    uint32_t stalled = 0;
+    bool stall_aligned = false;
+};
+
+#endif //NESEMULATOR_SCHEDULER_H
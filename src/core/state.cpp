@@ -2,20 +2,67 @@
 
 #include "array"
 #include "basics.h"
+#include <algorithm>
 #include <iostream>
 #include "state.h"
 
 using namespace std;
 
+constexpr uint8_t LAZY_FLAGS_MASK = 0xC3; // N, V, Z, C
+
 bool Reg::get_flag(FlagPositions flag) const {
-    return (P.val >> static_cast<int>(flag)) & 1;
+    switch (flag) {
+        case FlagPositions::CARRY:
+            return (c_src >> 8) & 1;
+        case FlagPositions::ZERO:
+            return z_src == 0;
+        case FlagPositions::OVF:
+            return v_src & 0x80;
+        case FlagPositions::NEG:
+            return n_src & 0x80;
+        default:
+            return (P.val >> static_cast<int>(flag)) & 1;
+    }
 }
 
 void Reg::set_flag(FlagPositions flag, bool value) {
-    if (value)
-        P.val |= 1 << static_cast<int>(flag);
-    else
-        P.val &= ~(1 << static_cast<int>(flag));
+    switch (flag) {
+        case FlagPositions::CARRY:
+            c_src = value ? 0x100 : 0;
+            break;
+        case FlagPositions::ZERO:
+            z_src = value ? 0 : 1;
+            break;
+        case FlagPositions::OVF:
+            v_src = value ? 0x80 : 0;
+            break;
+        case FlagPositions::NEG:
+            n_src = value ? 0x80 : 0;
+            break;
+        default:
+            if (value)
+                P.val |= 1 << static_cast<int>(flag);
+            else
+                P.val &= ~(1 << static_cast<int>(flag));
+    }
+}
+
+void Reg::set_nz(Val result) {
+    n_src = result.val;
+    z_src = result.val;
+}
+
+void Reg::set_nz(Val n_source, Val z_source) {
+    n_src = n_source.val;
+    z_src = z_source.val;
+}
+
+void Reg::set_carry_from(uint16_t source) {
+    c_src = source;
+}
+
+void Reg::set_ovf_from(uint8_t source) {
+    v_src = source;
 }
 
 Val Reg::getA() const {
@@ -63,58 +110,148 @@ void Reg::setS(Val s) {
 }
 
 Val Reg::getP() const {
-    return P;
+    uint8_t p = P.val;
+    p |= n_src & 0x80;
+    p |= (v_src & 0x80) >> 1;
+    p |= z_src == 0 ? 0x02 : 0;
+    p |= (c_src >> 8) & 1;
+    return Val(p);
 }
 
 void Reg::setP(Val p) {
-    P = p;
+    P = Val(p.val & ~LAZY_FLAGS_MASK);
+    n_src = p.val;
+    v_src = p.val << 1;
+    z_src = ~p.val & 0x02;
+    c_src = (p.val & 1) << 8;
 }
 
 
+Memory::Memory() {
+    map_nes();
+}
+
 void Memory::write_byte(uint16_t address, uint8_t value) {
-//    if (address < 0x2000) {
-//        ram[address % RAM_SIZE] = value;
-//        written[address % RAM_SIZE] = true;
-//    } else if (address < 0x4000) {
-//        ppu_registers[(address - 0x2000) % PPU_REGISTERS_SIZE] = value;
-//    } else if (address < 0x4020) {
-//        apu_io_registers[address - 0x4000] = value;
-//    } else if (address >= 0xFFFA && address <= 0xFFFF) {
-//        interrupt_vec[address - 0xFFFA] = value;
-//    } else if (address >= 0x8000) {
-//        prg_rom[address - 0x8000] = value;
-//    } else {
-    misc_mem[address] = value;
-    //}
+    uint8_t *page = write_pages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = value;
+        return;
+    }
+    const MmioHandler &handler = handlers[page_handlers[address >> 8]];
+    handler.write(handler.context, address, value);
 }
 
 uint8_t Memory::read_byte(uint16_t address) {
-//    if (address < 0x2000) {
-//        if (!written[address % RAM_SIZE])
-//            throw invalid_argument("Ram not initialized at address " + to_string(address));
-//        return ram[address % RAM_SIZE];
-//    } else if (address < 0x4000) {
-//        return ppu_registers[(address - 0x2000) % PPU_REGISTERS_SIZE];
-//    } else if (address < 0x4020) {
-//        return apu_io_registers[address - 0x4000];
-//    } else if (address >= 0xFFFA && address <= 0xFFFF) {
-//        return interrupt_vec[address - 0xFFFA];
-//    } else if (address >= 0x8000) {
-//        return prg_rom[address - 0x8000];
-//    } else {
-    return misc_mem[address];
-    //}
-}
-
-void Memory::loadCartridge(const std::vector<uint8_t> &romData) {
-    // Assuming PRG-ROM data starts at the beginning of romData
-    std::copy(romData.begin(), romData.begin() + PRG_ROM_SIZE, prg_rom.begin());
+    const uint8_t *page = read_pages[address >> 8];
+    if (page)
+        return page[address & 0xFF];
+    const MmioHandler &handler = handlers[page_handlers[address >> 8]];
+    return handler.read(handler.context, address);
+}
+
+void Memory::map_ram(uint8_t first_page, int page_count, uint8_t *data, uint32_t size) {
+    map_read(first_page, page_count, data, size);
+    map_write(first_page, page_count, data, size);
+}
+
+void Memory::map_read(uint8_t first_page, int page_count, const uint8_t *data, uint32_t size) {
+    for (int i = 0; i < page_count; i++)
+        read_pages[first_page + i] = data + (i * 0x100) % size;
+}
+
+void Memory::map_write(uint8_t first_page, int page_count, uint8_t *data, uint32_t size) {
+    for (int i = 0; i < page_count; i++) {
+        write_pages[first_page + i] = data + (i * 0x100) % size;
+        writable_pages[first_page + i] = true;
+    }
+}
+
+void Memory::map_mmio(uint8_t first_page, int page_count, MmioHandler handler) {
+    uint8_t slot = register_handler(handler);
+    for (int i = first_page; i < first_page + page_count; i++) {
+        read_pages[i] = nullptr;
+        write_pages[i] = nullptr;
+        writable_pages[i] = false;
+        page_handlers[i] = slot;
+    }
+}
+
+void Memory::map_mmio_write(uint8_t first_page, int page_count, MmioHandler handler) {
+    uint8_t slot = register_handler(handler);
+    for (int i = first_page; i < first_page + page_count; i++) {
+        write_pages[i] = nullptr;
+        writable_pages[i] = false;
+        page_handlers[i] = slot;
+    }
+}
+
+uint8_t Memory::register_handler(MmioHandler handler) {
+    for (uint8_t i = 0; i < handler_count; i++)
+        if (handlers[i] == handler)
+            return i;
+    if (handler_count == MAX_MMIO_HANDLERS)
+        throw runtime_error("Too many MMIO handlers");
+    handlers[handler_count] = handler;
+    return handler_count++;
+}
+
+void Memory::map_nes() {
+    handler_count = 0;
+    map_mmio(0x00, PAGE_COUNT, {open_bus_read, open_bus_write, this});
+    //2KB internal RAM, mirrored up to $1FFF
+    map_ram(0x00, 0x20, ram.data(), RAM_SIZE);
+    //$2000-$3FFF and the APU and I/O registers in page $40 stay open bus until a PPU and
+    //APU attach; the rest is cartridge space, open until a mapper attaches
+}
+
+void Memory::map_flat() {
+    if (!flat_ram)
+        flat_ram = std::make_unique<uint8_t[]>(0x10000);
+    map_read(0x00, PAGE_COUNT, flat_ram.get(), 0x10000);
+    //Writes start out behind flat_write, which hands each page over to the direct path as
+    //soon as it has been recorded, so tracking costs one call per page rather than per write
+    map_mmio_write(0x00, PAGE_COUNT, {open_bus_read, flat_write, this});
+    writable_pages.fill(true);
+    touched_pages.clear();
+    touched_pages.reserve(PAGE_COUNT);
+}
+
+std::span<const uint8_t> Memory::flat() const {
+    if (!flat_ram)
+        return {};
+    return {flat_ram.get(), 0x10000};
+}
+
+void Memory::restore_touched(const uint8_t *image) {
+    for (uint8_t page : touched_pages)
+        std::copy_n(image + page * 0x100, 0x100, flat_ram.get() + page * 0x100);
+    clear_touched();
+}
+
+void Memory::clear_touched() {
+    for (uint8_t page : touched_pages)
+        write_pages[page] = nullptr;
+    touched_pages.clear();
+}
+
+void Memory::flat_write(void *context, uint16_t address, uint8_t value) {
+    auto *memory = static_cast<Memory *>(context);
+    uint8_t page = address >> 8;
+    memory->touched_pages.push_back(page);
+    memory->write_pages[page] = memory->flat_ram.get() + page * 0x100;
+    memory->write_pages[page][address & 0xFF] = value;
+}
+
+//Nothing drives the bus here; open bus behaviour isn't emulated
+uint8_t Memory::open_bus_read(void *context, uint16_t address) {
+    return 0;
+}
+
+void Memory::open_bus_write(void *context, uint16_t address, uint8_t value) {
 }
 
 void Memory::power() {
-    for (int i = 0; i < RAM_SIZE; i++)
-        ram[i] = 0;
-    std::fill(interrupt_vec.begin(), interrupt_vec.end(), 0xFF);
+    ram.fill(0);
 }
 
 
@@ -144,10 +281,9 @@ Val Cpu6502_State::add(Val left, Val right) {
     Val carry = Val(r.get_flag(FlagPositions::CARRY) ? 1 : 0);
     Val res = left + right + carry;
     uint16_t ovf = (uint16_t) left.val + (uint16_t) right.val + carry.val;
-    r.set_flag(FlagPositions::CARRY, ovf > 0xFF);
-    r.set_flag(FlagPositions::ZERO, res.val == 0);
-    r.set_flag(FlagPositions::NEG, res.val & 0x80);
-    r.set_flag(FlagPositions::OVF, ((left ^ res) & (right ^ res) & Val(0x80)) != Val(0));
+    r.set_carry_from(ovf);
+    r.set_nz(res);
+    r.set_ovf_from(((left ^ res) & (right ^ res)).val);
     return res;
 }
 
@@ -163,11 +299,12 @@ Val Cpu6502_State::pull_stack() {
     return Val(m.read_byte(stack_addr));
 }
 
-Cpu6502_State::Cpu6502_State() {
-    m = {};
-    r = Reg();
-}
+Cpu6502_State::Cpu6502_State() = default;
 
 Memory &Cpu6502_State::mem() {
     return m;
+}
+
+InterruptLines &Cpu6502_State::interrupts() {
+    return lines;
 }
\ No newline at end of file
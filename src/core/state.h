@@ -1,14 +1,14 @@
 #include "array"
 #include "basics.h"
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <span>
 
 #ifndef NESEMULATOR_STATE_H
 #define NESEMULATOR_STATE_H
 
 constexpr uint16_t RAM_SIZE = 0x0800; // 2KB internal RAM
-constexpr uint16_t PPU_REGISTERS_SIZE = 8; // PPU registers
-constexpr uint16_t APU_IO_REGISTERS_SIZE = 0x18; // APU and I/O registers
-constexpr uint16_t PRG_ROM_SIZE = 0x8000;
 
 enum class FlagPositions {
     CARRY = 0,
@@ -29,6 +29,18 @@ public:
 
     void set_flag(FlagPositions flag, bool value);
 
+    //N and Z taken from a result byte, evaluated lazily when a flag or P is read
+    void set_nz(Val result);
+
+    //N from bit 7 of one byte and Z from another (BIT)
+    void set_nz(Val n_source, Val z_source);
+
+    //C from bit 8 of a 9-bit sum/shift, evaluated lazily
+    void set_carry_from(uint16_t source);
+
+    //V from bit 7 of a byte, evaluated lazily
+    void set_ovf_from(uint8_t source);
+
     [[nodiscard]] Val getA() const;
 
     void setA(Val a);
@@ -55,37 +67,153 @@ public:
 
     void setP(Val p);
 private:
+    //Native code works on the registers in place
+    friend class Jit;
+
     Val A;
     Val X;
     Val Y;
     Addr PC;
     Val S;
+    //Only I, D, B and the unused bit; N/Z/C/V are kept as the sources below
     Val P;
+    uint8_t n_src = 0;
+    uint8_t z_src = 1;
+    uint16_t c_src = 0;
+    uint8_t v_src = 0;
 };
 
+//Memory-mapped IO. The context pointer is handed back to the handler untouched.
+using MmioRead = uint8_t (*)(void *context, uint16_t address);
+using MmioWrite = void (*)(void *context, uint16_t address, uint8_t value);
+
+struct MmioHandler {
+    MmioRead read;
+    MmioWrite write;
+    void *context;
+
+    bool operator==(const MmioHandler &other) const = default;
+};
+
+//The CPU bus, decoded through a table of 256 byte pages. A page with a direct pointer is
+//plain memory (so mirroring is just several pages pointing at the same bytes); a page
+//without one goes to the MMIO handler registered for it. Read and write pointers are
+//separate so ROM pages can be read directly while writes reach a handler.
 class Memory {
 public:
-    Memory() = default;
+    Memory();
+
+    Memory(const Memory &) = delete;
+
+    Memory &operator=(const Memory &) = delete;
 
     void write_byte(uint16_t address, uint8_t value);
 
     uint8_t read_byte(uint16_t address);
 
-    void loadCartridge(const std::vector<uint8_t> &romData);
+    //Maps [first_page, first_page + page_count) onto data, repeating every size bytes
+    void map_ram(uint8_t first_page, int page_count, uint8_t *data, uint32_t size);
+
+    void map_read(uint8_t first_page, int page_count, const uint8_t *data, uint32_t size);
+
+    void map_write(uint8_t first_page, int page_count, uint8_t *data, uint32_t size);
+
+    //Routes both reads and writes of the pages to the handler
+    void map_mmio(uint8_t first_page, int page_count, MmioHandler handler);
+
+    //Routes only writes of the pages to the handler, reads keep their mapping
+    void map_mmio_write(uint8_t first_page, int page_count, MmioHandler handler);
+
+    //NES CPU memory map
+    void map_nes();
+
+    //64KB of plain RAM, as the single step processor tests expect. Only allocated when asked for.
+    //Writes to it are tracked per page, see restore_touched().
+    void map_flat();
+
+    //The flat RAM, empty when it isn't mapped
+    [[nodiscard]] std::span<const uint8_t> flat() const;
+
+    //Copies the flat pages written since the last clear back from image (64KB), then clears
+    void restore_touched(const uint8_t *image);
+
+    //Forgets which flat pages were written
+    void clear_touched();
+
+    [[nodiscard]] size_t touched_count() const {
+        return touched_pages.size();
+    }
+
+    //Where reads of a page come from; null when an MMIO handler answers them
+    [[nodiscard]] const uint8_t *read_page(uint8_t page) const {
+        return read_pages[page];
+    }
+
+    //Whether writes can change what reads of a page return: RAM, as opposed to ROM
+    [[nodiscard]] bool page_writable(uint8_t page) const {
+        return writable_pages[page];
+    }
 
     void power();
 private:
+    //Native code reads and writes plain pages through the tables itself
+    friend class Jit;
+
+    static constexpr int PAGE_COUNT = 0x100;
+    static constexpr int MAX_MMIO_HANDLERS = 8;
+
+    uint8_t register_handler(MmioHandler handler);
+
+    static uint8_t open_bus_read(void *context, uint16_t address);
+
+    //First write to an untouched flat page: records the page and maps it for direct writes
+    static void flat_write(void *context, uint16_t address, uint8_t value);
+
+    static void open_bus_write(void *context, uint16_t address, uint8_t value);
+
+    std::array<const uint8_t *, PAGE_COUNT> read_pages = {};
+    std::array<uint8_t *, PAGE_COUNT> write_pages = {};
+    std::array<uint8_t, PAGE_COUNT> page_handlers = {};
+    std::array<bool, PAGE_COUNT> writable_pages = {};
+    std::array<MmioHandler, MAX_MMIO_HANDLERS> handlers = {};
+    uint8_t handler_count = 0;
+
+    //Per-instance storage is just the 2KB work RAM; PRG-RAM and CHR-RAM belong to the mapper
+    //and ROM is shared through the Cartridge
     std::array<uint8_t, RAM_SIZE> ram = {};
-    std::array<bool, RAM_SIZE> written = {};
-    std::array<uint8_t, PPU_REGISTERS_SIZE> ppu_registers = {};
-    std::array<uint8_t, APU_IO_REGISTERS_SIZE> apu_io_registers = {};
-    std::array<uint8_t, PRG_ROM_SIZE> prg_rom = {};
-    std::array<uint8_t, 6> interrupt_vec = {};
-    std::array<uint8_t, 0x10000> misc_mem = {};
+    std::unique_ptr<uint8_t[]> flat_ram;
+    std::vector<uint8_t> touched_pages;
 
 };
 
 
+//IRQ is level-triggered and wired-OR: each source drives its own bit
+enum IrqSource : uint8_t {
+    IRQ_APU_FRAME = 0x01,
+    IRQ_APU_DMC = 0x02,
+    IRQ_MAPPER = 0x04
+};
+
+//The CPU's interrupt inputs, sampled between instructions
+class InterruptLines {
+public:
+    void set_irq(IrqSource source, bool active) {
+        irq = active ? irq | source : irq & ~source;
+    }
+
+    //NMI is edge-triggered; the edge is latched until the CPU services it
+    void trigger_nmi() {
+        nmi = true;
+    }
+
+    [[nodiscard]] bool any() const {
+        return irq | nmi;
+    }
+
+    uint8_t irq = 0;
+    bool nmi = false;
+};
+
 class Cpu6502_State {
 public:
     void set_byte(Addr loc, Val data);
@@ -107,9 +235,12 @@ public:
     Cpu6502_State();
 
     Memory& mem();
+
+    InterruptLines &interrupts();
 private:
     Memory m;
     Reg r;
+    InterruptLines lines;
 };
 
 #endif //NESEMULATOR_STATE_H
@@ -0,0 +1,142 @@
+#include "test_vectors.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NESEMULATOR_HAS_MMAP 1
+#endif
+
+using namespace std;
+
+namespace {
+    constexpr char MAGIC[8] = {'N', 'E', 'S', 'T', 'V', 'E', 'C', 0};
+    constexpr uint32_t VERSION = 1;
+}
+
+TestVectorFile::TestVectorFile(const string &path) {
+#ifdef NESEMULATOR_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Can't open test vectors " + path);
+    struct stat info{};
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw runtime_error("Can't read test vectors " + path);
+    }
+    mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw runtime_error("Can't map test vectors " + path);
+    }
+    mapping_size = info.st_size;
+    //Cases are read front to back, once
+    madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+    try {
+        parse(static_cast<const uint8_t *>(mapping), mapping_size);
+    } catch (...) {
+        munmap(mapping, mapping_size);
+        throw;
+    }
+#else
+    ifstream stream(path, ios::binary);
+    if (!stream.is_open())
+        throw runtime_error("Can't open test vectors " + path);
+    owned.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    parse(owned.data(), owned.size());
+#endif
+}
+
+TestVectorFile::~TestVectorFile() {
+#ifdef NESEMULATOR_HAS_MMAP
+    if (mapping)
+        munmap(mapping, mapping_size);
+#endif
+}
+
+void TestVectorFile::parse(const uint8_t *data, size_t size) {
+    TestVectorHeader header;
+    if (size < sizeof(header))
+        throw invalid_argument("Test vector file doesn't contain a header.");
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+        throw invalid_argument("Not a version " + to_string(VERSION) + " test vector file.");
+
+    size_t records_start = sizeof(header);
+    size_t ram_start = records_start + header.case_count * sizeof(TestVectorRecord);
+    size_t bus_start = ram_start + header.ram_count * sizeof(RamEntry);
+    size_t names_start = bus_start + header.cycle_count * sizeof(BusCycle);
+    if (size != names_start + header.names_size)
+        throw runtime_error("Test vector file size does not match header information");
+
+    records = {reinterpret_cast<const TestVectorRecord *>(data + records_start), header.case_count};
+    ram = {reinterpret_cast<const RamEntry *>(data + ram_start), header.ram_count};
+    bus = {reinterpret_cast<const BusCycle *>(data + bus_start), header.cycle_count};
+    names = {reinterpret_cast<const char *>(data + names_start), header.names_size};
+    for (const TestVectorRecord &record : records) {
+        if (static_cast<uint64_t>(record.initial_ram) + record.initial_ram_count > ram.size() ||
+            static_cast<uint64_t>(record.final_ram) + record.final_ram_count > ram.size() ||
+            static_cast<uint64_t>(record.cycles) + record.cycle_count > bus.size() ||
+            static_cast<uint64_t>(record.name) + record.name_length > names.size())
+            throw runtime_error("Test vector record points outside the file");
+    }
+}
+
+TestCaseView TestVectorFile::operator[](size_t index) const {
+    const TestVectorRecord &record = records[index];
+    return {names.substr(record.name, record.name_length), record.initial, record.final,
+            ram.subspan(record.initial_ram, record.initial_ram_count),
+            ram.subspan(record.final_ram, record.final_ram_count),
+            bus.subspan(record.cycles, record.cycle_count)};
+}
+
+void TestVectorWriter::add(const TestCaseView &test) {
+    if (test.initial_ram.size() > UINT16_MAX || test.final_ram.size() > UINT16_MAX ||
+        test.cycles.size() > UINT16_MAX || test.name.size() > UINT16_MAX)
+        throw invalid_argument("Test case " + string(test.name) + " is too big for the format");
+    TestVectorRecord record = {};
+    record.initial = test.initial;
+    record.final = test.final;
+    record.initial_ram = static_cast<uint32_t>(ram.size());
+    record.initial_ram_count = static_cast<uint16_t>(test.initial_ram.size());
+    ram.insert(ram.end(), test.initial_ram.begin(), test.initial_ram.end());
+    record.final_ram = static_cast<uint32_t>(ram.size());
+    record.final_ram_count = static_cast<uint16_t>(test.final_ram.size());
+    ram.insert(ram.end(), test.final_ram.begin(), test.final_ram.end());
+    record.cycles = static_cast<uint32_t>(bus.size());
+    record.cycle_count = static_cast<uint16_t>(test.cycles.size());
+    bus.insert(bus.end(), test.cycles.begin(), test.cycles.end());
+    record.name = static_cast<uint32_t>(names.size());
+    record.name_length = static_cast<uint16_t>(test.name.size());
+    names += test.name;
+    records.push_back(record);
+}
+
+void TestVectorWriter::write(const string &path) const {
+    TestVectorHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.case_count = static_cast<uint32_t>(records.size());
+    header.ram_count = static_cast<uint32_t>(ram.size());
+    header.cycle_count = static_cast<uint32_t>(bus.size());
+    header.names_size = static_cast<uint32_t>(names.size());
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.is_open())
+        throw runtime_error("Can't create test vectors " + path);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(TestVectorRecord));
+    file.write(reinterpret_cast<const char *>(ram.data()), ram.size() * sizeof(RamEntry));
+    file.write(reinterpret_cast<const char *>(bus.data()), bus.size() * sizeof(BusCycle));
+    file.write(names.data(), names.size());
+    if (!file)
+        throw runtime_error("Can't write test vectors " + path);
+}
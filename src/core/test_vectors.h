@@ -0,0 +1,146 @@
+#ifndef NESEMULATOR_TEST_VECTORS_H
+#define NESEMULATOR_TEST_VECTORS_H
+
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//Packed single-instruction test vectors (the SingleStepTests ProcessorTests), so a run
+//never parses anything. A file is a header followed by four tables:
+//
+//  TestVectorHeader
+//  TestVectorRecord[case_count]   fixed-size, pointing into the tables below
+//  RamEntry[ram_count]            every case's initial then final RAM
+//  BusCycle[cycle_count]          every case's bus activity, if it was converted with it
+//  char[names_size]               case names, not terminated
+//
+//All fields are little-endian and naturally aligned, so the reader uses the mapping as is.
+
+static_assert(std::endian::native == std::endian::little, "test vectors are read in place");
+
+//CPU registers at the start or end of a case
+struct CpuRecord {
+    uint16_t pc;
+    uint8_t s;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t reserved;
+};
+
+struct RamEntry {
+    uint16_t address;
+    uint8_t value;
+    uint8_t reserved;
+};
+
+//One bus access of the instruction, in order
+struct BusCycle {
+    uint16_t address;
+    uint8_t value;
+    uint8_t write;
+};
+
+struct TestVectorRecord {
+    CpuRecord initial;
+    CpuRecord final;
+    //Index of the first entry in the RAM / cycle tables, and offset into the names
+    uint32_t initial_ram;
+    uint32_t final_ram;
+    uint32_t cycles;
+    uint32_t name;
+    uint16_t initial_ram_count;
+    uint16_t final_ram_count;
+    uint16_t cycle_count;
+    uint16_t name_length;
+};
+
+struct TestVectorHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t case_count;
+    uint32_t ram_count;
+    uint32_t cycle_count;
+    uint32_t names_size;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(CpuRecord) == 8 && sizeof(RamEntry) == 4 && sizeof(BusCycle) == 4);
+static_assert(sizeof(TestVectorRecord) == 40 && sizeof(TestVectorHeader) == 32);
+
+//One case, wherever it is stored
+struct TestCaseView {
+    std::string_view name;
+    CpuRecord initial;
+    CpuRecord final;
+    std::span<const RamEntry> initial_ram;
+    std::span<const RamEntry> final_ram;
+    //Empty when the source doesn't have them
+    std::span<const BusCycle> cycles;
+};
+
+//A case holding its own lists, for sources that aren't laid out like the file (JSON)
+struct TestCase {
+    std::string name;
+    CpuRecord initial = {};
+    CpuRecord final = {};
+    std::vector<RamEntry> initial_ram;
+    std::vector<RamEntry> final_ram;
+    std::vector<BusCycle> cycles;
+
+    [[nodiscard]] TestCaseView view() const {
+        return {name, initial, final, initial_ram, final_ram, cycles};
+    }
+};
+
+//A test vector file mapped read-only. Cases are looked up in place; the header and table
+//bounds are validated once when it's opened.
+class TestVectorFile {
+public:
+    explicit TestVectorFile(const std::string &path);
+
+    ~TestVectorFile();
+
+    TestVectorFile(const TestVectorFile &) = delete;
+
+    TestVectorFile &operator=(const TestVectorFile &) = delete;
+
+    [[nodiscard]] size_t size() const {
+        return records.size();
+    }
+
+    [[nodiscard]] TestCaseView operator[](size_t index) const;
+
+private:
+    void parse(const uint8_t *data, size_t size);
+
+    std::span<const TestVectorRecord> records;
+    std::span<const RamEntry> ram;
+    std::span<const BusCycle> bus;
+    std::string_view names;
+
+    std::vector<uint8_t> owned;
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+};
+
+//Collects cases and writes them out as a test vector file
+class TestVectorWriter {
+public:
+    void add(const TestCaseView &test);
+
+    //Throws if the file can't be written
+    void write(const std::string &path) const;
+
+private:
+    std::vector<TestVectorRecord> records;
+    std::vector<RamEntry> ram;
+    std::vector<BusCycle> bus;
+    std::string names;
+};
+
+#endif //NESEMULATOR_TEST_VECTORS_H
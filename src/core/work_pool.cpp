@@ -0,0 +1,96 @@
+#include "work_pool.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+    //The pool and index of the worker running on this thread, if any
+    thread_local const WorkPool *current_pool = nullptr;
+    thread_local size_t current_worker = 0;
+}
+
+WorkPool::WorkPool(unsigned count) {
+    count = max(count, 1u);
+    for (unsigned i = 0; i < count; i++)
+        workers.push_back(make_unique<Worker>());
+    for (unsigned i = 0; i < count; i++)
+        threads.emplace_back(&WorkPool::run, this, i);
+}
+
+WorkPool::~WorkPool() {
+    stopping.store(true, memory_order_release);
+    posted.fetch_add(1, memory_order_release);
+    posted.notify_all();
+    for (thread &t : threads)
+        t.join();
+}
+
+void WorkPool::submit(Task task) {
+    size_t target = current_pool == this ? current_worker
+                                         : next_worker.fetch_add(1, memory_order_relaxed) % workers.size();
+    unfinished.fetch_add(1, memory_order_relaxed);
+    queued.fetch_add(1, memory_order_relaxed);
+    {
+        lock_guard<mutex> guard(workers[target]->lock);
+        workers[target]->tasks.push_back(std::move(task));
+    }
+    posted.fetch_add(1, memory_order_release);
+    posted.notify_one();
+}
+
+void WorkPool::wait() {
+    size_t left = unfinished.load(memory_order_acquire);
+    while (left != 0) {
+        unfinished.wait(left, memory_order_acquire);
+        left = unfinished.load(memory_order_acquire);
+    }
+}
+
+bool WorkPool::pop(size_t self, Task &task) {
+    Worker &worker = *workers[self];
+    lock_guard<mutex> guard(worker.lock);
+    if (worker.tasks.empty())
+        return false;
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool WorkPool::steal(size_t self, Task &task) {
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker &victim = *workers[(self + i) % workers.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if (victim.tasks.empty())
+            continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::run(size_t self) {
+    current_pool = this;
+    current_worker = self;
+    while (true) {
+        //Read first: a push after this bumps posted, so the wait below can't miss it
+        uint32_t seen = posted.load(memory_order_acquire);
+        if (queued.load(memory_order_acquire) == 0) {
+            if (stopping.load(memory_order_acquire))
+                return;
+            posted.wait(seen, memory_order_acquire);
+            continue;
+        }
+        Task task;
+        //Counted but not pushed yet, or taken by another worker first
+        if (!pop(self, task) && !steal(self, task)) {
+            this_thread::yield();
+            continue;
+        }
+        queued.fetch_sub(1, memory_order_relaxed);
+        task();
+        task = nullptr;
+        if (unfinished.fetch_sub(1, memory_order_acq_rel) == 1)
+            unfinished.notify_all();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef NESEMULATOR_WORK_POOL_H
+#define NESEMULATOR_WORK_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A fixed set of threads running tasks with work stealing. Each worker keeps its own
+//deque: it pushes and pops its own work at the back, so a task's subtasks stay on the
+//thread that made them, and when it runs dry it steals from the front of the others'.
+//The only locks are the deques' own; the counts are atomics and idle workers sleep on an
+//atomic wait. Tasks must not throw.
+class WorkPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkPool(unsigned threads);
+
+    ~WorkPool();
+
+    WorkPool(const WorkPool &) = delete;
+
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    //From a task this queues on the calling worker; from outside, on each worker in turn
+    void submit(Task task);
+
+    //Blocks until every task submitted so far, and everything they submitted, has run
+    void wait();
+
+    [[nodiscard]] unsigned size() const {
+        return static_cast<unsigned>(threads.size());
+    }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    bool pop(size_t self, Task &task);
+
+    bool steal(size_t self, Task &task);
+
+    void run(size_t self);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    //Tasks sitting in some deque, and tasks not yet finished. Both are counted before the
+    //push, so whoever pops a task can always count it off.
+    alignas(64) std::atomic<size_t> queued = 0;
+    alignas(64) std::atomic<size_t> unfinished = 0;
+    //Bumped after each push and on shutdown, for idle workers to wait on
+    alignas(64) std::atomic<uint32_t> posted = 0;
+    std::atomic<size_t> next_worker = 0;
+    std::atomic<bool> stopping = false;
+};
+
+#endif //NESEMULATOR_WORK_POOL_H
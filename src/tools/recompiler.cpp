@@ -0,0 +1,211 @@
+//Recompiles an NROM image to C++ ahead of time. Code is traced from the NMI, reset and IRQ
+//vectors (and any extra entry points given), following jumps, branches, calls and the
+//returns from them, and cut into basic blocks. Each block becomes a function of calls to
+//the opcode handlers with its operands built in, and a loop dispatches between them on PC;
+//see precompiled.h for how the result is run.
+//Usage: NESRecompiler [--symbol name] <rom.nes> <out.cpp> [entry point in hex]...
+#include "../core/cartridge.h"
+#include "../core/instructions.h"
+#include "../core/precompiled.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    constexpr uint8_t JSR = 0x20;
+    constexpr uint8_t JMP_ABSOLUTE = 0x4C;
+    constexpr uint8_t JMP_INDIRECT = 0x6C;
+    constexpr uint8_t RTI = 0x40;
+    constexpr uint8_t CLI = 0x58;
+    constexpr uint8_t PLP = 0x28;
+
+    bool is_branch(uint8_t opcode) {
+        return (opcode & 0x1F) == 0x10;
+    }
+
+    //PRG-ROM as the CPU sees it from $8000, a 16KB image mirrored at $C000
+    struct Image {
+        span<const uint8_t> prg;
+
+        [[nodiscard]] uint8_t read(uint16_t addr) const {
+            return prg[(addr - 0x8000) % prg.size()];
+        }
+
+        [[nodiscard]] uint16_t read_word(uint16_t addr) const {
+            return read(addr) | read(addr + 1) << 8;
+        }
+
+        //Whether a whole instruction fits in ROM at pc; RAM is never compiled
+        [[nodiscard]] bool has_instruction(uint32_t pc) const {
+            return pc >= 0x8000 && pc + opcodes[read(pc)].length <= 0x10000;
+        }
+
+        [[nodiscard]] uint16_t operand(uint16_t pc) const {
+            int length = opcodes[read(pc)].length;
+            return length == 1 ? 0 : length == 2 ? read(pc + 1) : read_word(pc + 1);
+        }
+    };
+
+    struct Trace {
+        //Instructions reached, and those that start a basic block
+        vector<bool> visited = vector<bool>(0x10000);
+        vector<bool> leaders = vector<bool>(0x10000);
+        vector<uint16_t> pending;
+
+        void enter(uint16_t pc) {
+            if (!leaders[pc]) {
+                leaders[pc] = true;
+                pending.push_back(pc);
+            }
+        }
+    };
+
+    void trace(const Image &image, Trace &t) {
+        while (!t.pending.empty()) {
+            uint32_t pc = t.pending.back();
+            t.pending.pop_back();
+            while (image.has_instruction(pc) && !t.visited[pc]) {
+                t.visited[pc] = true;
+                uint8_t opcode = image.read(pc);
+                const OpcodeInfo &info = opcodes[opcode];
+                uint16_t operand = image.operand(pc);
+                uint16_t next_pc = pc + info.length;
+                if (opcode == JMP_ABSOLUTE || opcode == JSR)
+                    t.enter(operand);
+                //Only a pointer in ROM stays put; through RAM the target is left to run time
+                if (opcode == JMP_INDIRECT && operand >= 0x8000)
+                    t.enter(image.read(operand) | image.read((operand & 0xFF00) | ((operand + 1) & 0xFF)) << 8);
+                if (is_branch(opcode))
+                    t.enter(next_pc + static_cast<int8_t>(operand));
+                if (is_branch(opcode) || opcode == JSR || opcode == CLI || opcode == PLP)
+                    t.enter(next_pc);
+                if (info.ends_block)
+                    break;
+                pc = next_pc;
+            }
+        }
+    }
+
+    string hex(unsigned value, int digits) {
+        char text[16];
+        snprintf(text, sizeof(text), "%0*X", digits, value);
+        return text;
+    }
+
+    //Writes a function for each block, listing where they start and counting instructions
+    void emit_blocks(const Image &image, const Trace &t, ostream &out, vector<uint16_t> &starts, size_t &length) {
+        for (uint32_t start = 0x8000; start < 0x10000; start++) {
+            if (!t.leaders[start] || !image.has_instruction(start))
+                continue;
+            starts.push_back(start);
+            string body;
+            uint32_t pc = start;
+            const char *exit = "NEXT";
+            while (true) {
+                uint8_t opcode = image.read(pc);
+                const OpcodeInfo &info = opcodes[opcode];
+                uint32_t next_pc = pc + info.length;
+                body += "        if (!run.may_continue())\n"
+                        "            return PrecompiledExit::LEAVE;\n"
+                        "        if (run.step<0x" + hex(opcode, 2) + ">(0x" + hex(image.operand(pc), 4) +
+                        ", 0x" + hex(next_pc & 0xFFFF, 4) + "))\n"
+                        "            return PrecompiledExit::STOP;\n";
+                length++;
+                //An IRQ held off by I may be taken after these, which is the interpreter's job
+                if (opcode == CLI || opcode == PLP || opcode == RTI)
+                    exit = "LEAVE";
+                if (info.ends_block || !image.has_instruction(next_pc) || t.leaders[next_pc])
+                    break;
+                pc = next_pc;
+            }
+            out << "    //$" << hex(start, 4) << "-$" << hex(pc, 4) << "\n"
+                << "    PrecompiledExit block_" << hex(start, 4) << "(PrecompiledRun &run) {\n"
+                << body
+                << "        return PrecompiledExit::" << exit << ";\n"
+                << "    }\n\n";
+        }
+    }
+
+    void recompile(const Cartridge &cartridge, const vector<uint16_t> &entries, const string &symbol,
+                   const string &name, ostream &out) {
+        if (cartridge.mapper_number != 0)
+            throw invalid_argument("Only NROM (mapper 0) images can be recompiled, not mapper " +
+                                   to_string(cartridge.mapper_number));
+        if (cartridge.prg_rom.size() != 0x4000 && cartridge.prg_rom.size() != 0x8000)
+            throw invalid_argument("NROM needs 16KB or 32KB of PRG-ROM");
+        Image image{cartridge.prg_rom};
+        Trace t;
+        for (uint16_t vector_addr : {NMI_VECTOR, uint16_t(0xFFFC), IRQ_VECTOR})
+            t.enter(image.read_word(vector_addr));
+        for (uint16_t entry : entries)
+            t.enter(entry);
+        trace(image, t);
+
+        stringstream blocks;
+        vector<uint16_t> starts;
+        size_t length = 0;
+        emit_blocks(image, t, blocks, starts, length);
+
+        out << "//Generated by NESRecompiler from " << name << ": " << starts.size() << " blocks, " << length
+            << " instructions. Regenerate rather than edit.\n"
+            << "#include \"precompiled_run.h\"\n\n"
+            << "namespace {\n"
+            << blocks.str()
+            << "    bool dispatch(JitFrame &frame) {\n"
+            << "        PrecompiledRun run(frame);\n"
+            << "        PrecompiledExit exit = PrecompiledExit::NEXT;\n"
+            << "        while (exit == PrecompiledExit::NEXT) {\n"
+            << "            switch (run.pc()) {\n";
+        for (uint16_t start : starts)
+            out << "                case 0x" << hex(start, 4) << ":\n"
+                << "                    exit = block_" << hex(start, 4) << "(run);\n"
+                << "                    break;\n";
+        out << "                default:\n"
+            << "                    exit = PrecompiledExit::LEAVE;\n"
+            << "            }\n"
+            << "        }\n"
+            << "        return run.leave(exit);\n"
+            << "    }\n"
+            << "}\n\n"
+            << "extern const PrecompiledRom " << symbol << " = {0x" << hex(cartridge.prg_rom.size(), 4) << ", 0x"
+            << hex(prg_rom_hash(cartridge.prg_rom) >> 32, 8) << hex(prg_rom_hash(cartridge.prg_rom) & 0xFFFFFFFF, 8)
+            << ", dispatch};\n";
+        cerr << name << ": " << starts.size() << " blocks, " << length << " instructions" << endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    string symbol = "precompiled_rom";
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--symbol" && i + 1 < argc)
+            symbol = argv[++i];
+        else
+            args.push_back(arg);
+    }
+    if (args.size() < 2) {
+        cerr << "Usage: NESRecompiler [--symbol name] <rom.nes> <out.cpp> [entry point in hex]..." << endl;
+        return 2;
+    }
+    try {
+        vector<uint16_t> entries;
+        for (size_t i = 2; i < args.size(); i++)
+            entries.push_back(static_cast<uint16_t>(stoul(args[i], nullptr, 16)));
+        shared_ptr<const Cartridge> cartridge = Cartridge::open(args[0]);
+        ofstream out(args[1]);
+        string name = args[0].substr(args[0].find_last_of('/') + 1);
+        recompile(*cartridge, entries, symbol, name, out);
+        if (!out)
+            throw runtime_error("Failed to write " + args[1]);
+    } catch (const exception &e) {
+        cerr << "NESRecompiler: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}